@@ -0,0 +1,37 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bench.h"
+
+// Measures the rate of the sequencer, in events per second, for files which
+// split the same count of notes over more and more tracks.
+int main()
+{
+    const unsigned total_notes = 100000;
+    const unsigned runs = 3;
+
+    printf("%8s %12s\n", "tracks", "events/s");
+    for (unsigned tracks = 1; tracks <= 4096; tracks *= 4) {
+        fmidi_smf_u smf(bench_make_song(tracks, total_notes / tracks));
+        if (!smf)
+            return 1;
+        fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+
+        double best = 0;
+        size_t count = 0;
+        for (unsigned n = 0; n < runs; ++n) {
+            fmidi_seq_rewind(seq.get());
+            double start = bench_now();
+            count = 0;
+            for (fmidi_seq_event_t sqevt; fmidi_seq_next_event(seq.get(), &sqevt);)
+                ++count;
+            double elapsed = bench_now() - start;
+            best = (n == 0 || elapsed < best) ? elapsed : best;
+        }
+        printf("%8u %12.3g\n", tracks, count / best);
+    }
+
+    return 0;
+}
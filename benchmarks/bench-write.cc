@@ -0,0 +1,65 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bench.h"
+#include <stdlib.h>
+
+// Measures the rate of the SMF writers, in MB/s of output, for a memory sink,
+// for a file written as a stream, and for a file written by name, which maps
+// a regular file. The file is created in the current directory, or at the
+// path given, and the count of notes per track can follow.
+int main(int argc, char *argv[])
+{
+    const char *filename = (argc > 1) ? argv[1] : "bench-write.mid";
+    unsigned notes = (argc > 2) ? (unsigned)atoi(argv[2]) : 200000;
+    const unsigned runs = 5;
+
+    fmidi_smf_u smf(bench_make_song(16, notes));
+    if (!smf)
+        return 1;
+    double size = fmidi_smf_encoded_size(smf.get());
+    printf("%u tracks, %.1f MB\n", fmidi_smf_get_info(smf.get())->track_count, size * 1e-6);
+
+    double best = 0;
+    for (unsigned n = 0; n < runs; ++n) {
+        double start = bench_now();
+        uint8_t *data = nullptr;
+        size_t length = 0;
+        if (!fmidi_smf_mem_write(smf.get(), &data, &length)) {
+            fprintf(stderr, "cannot write to memory\n");
+            return 1;
+        }
+        free(data);
+        double elapsed = bench_now() - start;
+        best = (n == 0 || elapsed < best) ? elapsed : best;
+    }
+    printf("memory: %8.1f MB/s\n", size * 1e-6 / best);
+
+    for (unsigned n = 0; n < runs; ++n) {
+        double start = bench_now();
+        FILE *stream = fopen(filename, "wb");
+        if (!stream || !fmidi_smf_stream_write(smf.get(), stream) || fclose(stream) != 0) {
+            fprintf(stderr, "cannot write the file: %s\n", filename);
+            return 1;
+        }
+        double elapsed = bench_now() - start;
+        best = (n == 0 || elapsed < best) ? elapsed : best;
+    }
+    printf("stream: %8.1f MB/s\n", size * 1e-6 / best);
+
+    for (unsigned n = 0; n < runs; ++n) {
+        double start = bench_now();
+        if (!fmidi_smf_file_write(smf.get(), filename)) {
+            fprintf(stderr, "cannot write the file: %s\n", filename);
+            return 1;
+        }
+        double elapsed = bench_now() - start;
+        best = (n == 0 || elapsed < best) ? elapsed : best;
+    }
+    printf("file:   %8.1f MB/s\n", size * 1e-6 / best);
+
+    remove(filename);
+    return 0;
+}
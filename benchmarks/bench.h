@@ -0,0 +1,55 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <fmidi/fmidi.h>
+#include <chrono>
+#include <stdio.h>
+
+////////////////
+// BENCHMARKS //
+////////////////
+
+// the time of a monotonic clock, in seconds
+inline double bench_now()
+{
+    typedef std::chrono::steady_clock clock;
+    return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+}
+
+// A file of format 1 with 96 ticks per beat, with the given count of tracks,
+// each with notes of the given count and a controller every 16 notes. The
+// tracks are of a different channel each, and the first one changes tempo.
+inline fmidi_smf_t *bench_make_song(unsigned tracks, unsigned notes)
+{
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(1, 96));
+    for (unsigned t = 0; t < tracks; ++t) {
+        fmidi_smf_builder_add_track(bld.get());
+        uint8_t channel = (uint8_t)(t % 16);
+        uint32_t delta = 0;
+        for (unsigned i = 0; i < notes; ++i) {
+            if (t == 0 && i % 1000 == 0) {
+                uint8_t tempo[] = {0x51, (uint8_t)(0x05 + (i / 1000) % 5), 0x00, 0x00};
+                fmidi_smf_builder_append(bld.get(), t, fmidi_event_meta, delta, tempo, 4);
+                delta = 0;
+            }
+            if (i % 16 == 0) {
+                uint8_t cc[] = {(uint8_t)(0xb0 | channel), 7, (uint8_t)(i % 128)};
+                fmidi_smf_builder_append(bld.get(), t, fmidi_event_message, delta, cc, 3);
+                delta = 0;
+            }
+            uint8_t key = (uint8_t)(36 + (i * 7 + t) % 60);
+            uint8_t on[] = {(uint8_t)(0x90 | channel), key, 100};
+            uint8_t off[] = {(uint8_t)(0x80 | channel), key, 64};
+            fmidi_smf_builder_append(bld.get(), t, fmidi_event_message, delta, on, 3);
+            fmidi_smf_builder_append(bld.get(), t, fmidi_event_message, 24 + t % 7, off, 3);
+            delta = 24;
+        }
+    }
+    fmidi_smf_t *smf = fmidi_smf_builder_finish(bld.get());
+    if (!smf)
+        fprintf(stderr, "cannot build the file: %s\n", fmidi_strerror(fmidi_errno()));
+    return smf;
+}
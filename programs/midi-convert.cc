@@ -4,6 +4,9 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "common.h"
+#include <memory>
+#include <string.h>
+#include <stdlib.h>
 #if !defined(_WIN32)
 #include <unistd.h>
 #else
@@ -14,6 +17,13 @@
 
 int main(int argc, char *argv[])
 {
+    unsigned flags = 0;
+    if (argc == 3 && !strcmp(argv[1], "-c")) {
+        flags = fmidi_write_compact;
+        --argc;
+        ++argv;
+    }
+
     if (argc != 2)
         return 1;
 
@@ -30,10 +40,25 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (!fmidi_smf_stream_write(smf.get(), stdout)) {
+    uint8_t *data = nullptr;
+    size_t length = 0;
+    if (!fmidi_smf_mem_write_ex(smf.get(), &data, &length, flags)) {
         print_error();
         return 1;
     }
+    std::unique_ptr<uint8_t, decltype(&free)> data_cleanup(data, &free);
+
+    if (fwrite(data, 1, length, stdout) != length || fflush(stdout) != 0) {
+        fprintf(stderr, "Cannot write the output.\n");
+        return 1;
+    }
+
+    if (flags != 0) {
+        size_t standard = fmidi_smf_encoded_size(smf.get());
+        size_t saved = (length < standard) ? (standard - length) : 0;
+        fprintf(stderr, "Compact encoding: %zu bytes, saved %zu bytes (%.1f%%)\n",
+                length, saved, 100.0 * saved / standard);
+    }
 
     return 0;
 }
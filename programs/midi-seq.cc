@@ -18,17 +18,20 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    fmidi_seq_u seq(fmidi_seq_new(smf.get()));
-    if (!seq) {
+    fmidi_timeline_u tl(fmidi_timeline_new(smf.get()));
+    if (!tl) {
         print_error();
         return 1;
     }
 
+    size_t count;
+    const fmidi_timeline_entry_t *entries = fmidi_timeline_entries(tl.get(), &count);
+
     fputs("(midi-sequence", stdout);
-    fmidi_seq_event_t plevt;
-    while (fmidi_seq_next_event(seq.get(), &plevt)) {
-        const fmidi_event_t *evt = plevt.event;
-        printf("\n  (%-3d %12.6f ", plevt.track, plevt.time);
+    for (size_t i = 0; i < count; ++i) {
+        const fmidi_timeline_entry_t &entry = entries[i];
+        const fmidi_event_t *evt = entry.event;
+        printf("\n  (%-3d %12.6f ", entry.track, entry.time * 1e-6);
         fmidi_event_describe(evt, stdout);
         fputc(')', stdout);
     }
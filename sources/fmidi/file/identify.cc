@@ -34,6 +34,17 @@ fmidi_fileformat_t fmidi_mem_identify(const uint8_t *data, size_t length)
     if (length >= 4 && memcmp(data, mus_magic, 4) == 0)
         return fmidi_fileformat_mus;
 
+    const uint8_t hmp_magic[8] = {'H', 'M', 'I', 'M', 'I', 'D', 'I', 'P'};
+    if (length >= 8 && memcmp(data, hmp_magic, 8) == 0)
+        return fmidi_fileformat_hmp;
+
+    const uint8_t hmi_magic[18] = {
+        'H', 'M', 'I', '-', 'M', 'I', 'D', 'I', 'S', 'O', 'N', 'G',
+        '0', '6', '1', '5', '9', '5'
+    };
+    if (length >= 18 && memcmp(data, hmi_magic, 18) == 0)
+        return fmidi_fileformat_hmi;
+
     RET_FAIL((fmidi_fileformat_t)-1, fmidi_err_format);
 }
 
@@ -58,6 +69,10 @@ fmidi_smf_t *fmidi_auto_mem_read(const uint8_t *data, size_t length)
         return fmidi_xmi_mem_read(data, length);
     case fmidi_fileformat_mus:
         return fmidi_mus_mem_read(data, length);
+    case fmidi_fileformat_hmp:
+        return fmidi_hmp_mem_read(data, length);
+    case fmidi_fileformat_hmi:
+        return fmidi_hmi_mem_read(data, length);
     default:
         return nullptr;
     }
@@ -82,6 +97,10 @@ fmidi_smf_t *fmidi_auto_stream_read(FILE *stream)
         return fmidi_xmi_stream_read(stream);
     case fmidi_fileformat_mus:
         return fmidi_mus_stream_read(stream);
+    case fmidi_fileformat_hmp:
+        return fmidi_hmp_stream_read(stream);
+    case fmidi_fileformat_hmi:
+        return fmidi_hmi_stream_read(stream);
     default:
         return nullptr;
     }
@@ -0,0 +1,437 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include "fmidi/u_memstream.h"
+#include "fmidi/u_stdio.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+# define fileno _fileno
+#endif
+
+// Human Machine Interfaces (HMI) sound operating system formats.
+// HMP and HMI differ in the layout of the headers, and in the event stream:
+// - HMP delta times are little-endian, and the high bit marks the final byte;
+//   the lengths of meta and sysex events are standard variable-length values
+// - HMI note-on events are followed by the duration of the note
+// - HMI has proprietary events with status 0xfe
+
+enum fmidi_hmi_variant {
+    fmidi_hmi_variant_hmp,
+    fmidi_hmi_variant_hmi,
+};
+
+struct fmidi_hmi_note {
+    uint64_t tick;
+    uint8_t channel;
+    uint8_t note;
+};
+
+static bool operator>(const fmidi_hmi_note &a, const fmidi_hmi_note &b)
+{
+    return a.tick > b.tick;
+}
+
+struct fmidi_hmi_span {
+    const uint8_t *data;
+    size_t length;
+};
+
+static memstream_status fmidi_hmi_readvlq(
+    memstream &mb, fmidi_hmi_variant variant, uint32_t *retp)
+{
+    if (variant != fmidi_hmi_variant_hmp)
+        return mb.readvlq(retp);
+
+    memstream_status ms;
+    uint32_t ret = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        unsigned byte;
+        if ((ms = mb.readbyte(&byte)))
+            return ms;
+        ret |= (byte & 127) << (7 * i);
+        if (byte & 128) {
+            *retp = ret;
+            return ms_ok;
+        }
+    }
+    return ms_err_format;
+}
+
+static void fmidi_hmi_emit_tempo(std::vector<uint8_t> &evbuf, uint32_t tempo)
+{
+    fmidi_event_t *event = fmidi_event_alloc(evbuf, 4);
+    event->type = fmidi_event_meta;
+    event->delta = 0;
+    event->datalen = 4;
+    uint8_t *data = event->data;
+    data[0] = 0x51;
+    data[1] = (tempo >> 16) & 0xff;
+    data[2] = (tempo >> 8) & 0xff;
+    data[3] = tempo & 0xff;
+}
+
+static bool fmidi_hmi_read_events(
+    memstream &mb, fmidi_hmi_variant variant, std::vector<uint8_t> &evbuf)
+{
+    memstream_status ms;
+
+    uint64_t tick = 0;  // time of the current event
+    uint64_t lasttick = 0;  // time of the last event emitted
+    unsigned runstatus = 0;
+
+    std::vector<fmidi_hmi_note> noteoffs;
+    noteoffs.reserve(128);
+    std::greater<fmidi_hmi_note> noteoff_order;
+
+    auto emit_noteoffs = [&](uint64_t until) {
+        while (!noteoffs.empty() && noteoffs.front().tick <= until) {
+            fmidi_hmi_note xn = noteoffs.front();
+            std::pop_heap(noteoffs.begin(), noteoffs.end(), noteoff_order);
+            noteoffs.pop_back();
+
+            fmidi_event_t *event = fmidi_event_alloc(evbuf, 3);
+            event->type = fmidi_event_message;
+            event->delta = xn.tick - lasttick;
+            event->datalen = 3;
+            uint8_t *data = event->data;
+            data[0] = 0x80 | xn.channel;
+            data[1] = xn.note;
+            data[2] = 64;
+            lasttick = xn.tick;
+        }
+    };
+
+    auto emit_event = [&](fmidi_event_type_t type, uint32_t datalen) -> fmidi_event_t * {
+        emit_noteoffs(tick);
+        fmidi_event_t *event = fmidi_event_alloc(evbuf, datalen);
+        event->type = type;
+        event->delta = tick - lasttick;
+        event->datalen = datalen;
+        lasttick = tick;
+        return event;
+    };
+
+    for (bool eot = false; !eot && mb.getpos() < mb.endpos();) {
+        uint32_t delta;
+        unsigned id;
+        if ((ms = fmidi_hmi_readvlq(mb, variant, &delta)) ||
+            (ms = mb.readbyte(&id))) {
+            if (ms == ms_err_eof)
+                break;  // truncated track, repair
+            RET_FAIL(false, (fmidi_status)ms);
+        }
+        tick += delta;
+
+        if (id == 0xff) {
+            unsigned type;
+            uint32_t length;
+            const uint8_t *data;
+            if (mb.readbyte(&type) ||
+                mb.readvlq(&length) ||
+                !(data = mb.read(length)))
+                break;  // truncated track, repair
+
+            eot = type == 0x2f;
+            if (eot) {
+                // emit later
+            }
+            else {
+                fmidi_event_t *event = emit_event(fmidi_event_meta, length + 1);
+                event->data[0] = type;
+                memcpy(event->data + 1, data, length);
+            }
+        }
+        else if (id == 0xf0 || id == 0xf7) {
+            uint32_t length;
+            const uint8_t *data;
+            if (mb.readvlq(&length) ||
+                !(data = mb.read(length)))
+                break;  // truncated track, repair
+
+            if (id == 0xf0) {
+                fmidi_event_t *event = emit_event(fmidi_event_message, length + 1);
+                event->data[0] = 0xf0;
+                memcpy(event->data + 1, data, length);
+            }
+            else {
+                fmidi_event_t *event = emit_event(fmidi_event_escape, length);
+                memcpy(event->data, data, length);
+            }
+        }
+        else if (id == 0xfe && variant == fmidi_hmi_variant_hmi) {
+            // proprietary event, skip it
+            unsigned type;
+            if (mb.readbyte(&type))
+                break;
+            if (type == 0x13 || type == 0x15)
+                ms = mb.skip(6);
+            else if (type == 0x12 || type == 0x14)
+                ms = mb.skip(2);
+            else if (type == 0x10) {
+                unsigned length;
+                if (!(ms = mb.skip(2)) && !(ms = mb.readbyte(&length)))
+                    ms = mb.skip(length + 4);
+            }
+            else
+                ms = ms_err_format;
+            if (ms)
+                break;  // unknown contents, stop here
+        }
+        else {
+            if (id & 128)
+                runstatus = id;
+            else {
+                id = runstatus;
+                mb.setpos(mb.getpos() - 1);
+            }
+
+            uint32_t length = fmidi_message_sizeof(id);
+            if (length <= 0)
+                RET_FAIL(false, fmidi_err_format);
+
+            const uint8_t *data;
+            if (!(data = mb.read(length - 1)))
+                break;  // truncated track, repair
+
+            fmidi_event_t *event = emit_event(fmidi_event_message, length);
+            event->data[0] = id;
+            memcpy(event->data + 1, data, length - 1);
+
+            if (variant == fmidi_hmi_variant_hmi && (id & 0xf0) == 0x90) {
+                uint32_t duration;
+                if (fmidi_hmi_readvlq(mb, variant, &duration))
+                    break;  // truncated track, repair
+                fmidi_hmi_note noteoff;
+                noteoff.tick = tick + duration;
+                noteoff.channel = id & 15;
+                noteoff.note = data[0];
+                noteoffs.push_back(noteoff);
+                std::push_heap(noteoffs.begin(), noteoffs.end(), noteoff_order);
+            }
+        }
+    }
+
+    emit_noteoffs(UINT64_MAX);
+
+    tick = std::max(tick, lasttick);
+    fmidi_event_t *event = emit_event(fmidi_event_meta, 1);
+    event->data[0] = 0x2f;
+
+    return true;
+}
+
+static fmidi_smf_t *fmidi_hmi_read_tracks(
+    const std::vector<fmidi_hmi_span> &spans, fmidi_hmi_variant variant,
+    uint16_t deltaunit, uint32_t tempo)
+{
+    size_t ntracks = spans.size();
+    if (ntracks < 1 || ntracks > UINT16_MAX)
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    fmidi_smf_u smf(new fmidi_smf);
+    smf->info.format = 1;
+    smf->info.track_count = ntracks;
+    smf->info.delta_unit = deltaunit;
+    smf->track.reset(new fmidi_raw_track[ntracks]);
+
+    std::vector<uint8_t> evbuf;
+    evbuf.reserve(8192);
+
+    for (size_t i = 0; i < ntracks; ++i) {
+        fmidi_raw_track &track = smf->track[i];
+        memstream mb(spans[i].data, spans[i].length);
+
+        evbuf.clear();
+        if (i == 0)
+            fmidi_hmi_emit_tempo(evbuf, tempo);
+        if (!fmidi_hmi_read_events(mb, variant, evbuf))
+            return nullptr;
+
+        uint32_t evdatalen = evbuf.size();
+        uint8_t *evdata = new uint8_t[evdatalen];
+        memcpy(evdata, evbuf.data(), evdatalen);
+        fmidi_raw_track_assign(track, evdata, evdatalen);
+    }
+
+    return smf.release();
+}
+
+static fmidi_smf_t *fmidi_hmi_stream_read_variant(
+    FILE *stream, fmidi_smf_t *(*mem_read)(const uint8_t *, size_t))
+{
+    struct stat st;
+    size_t length;
+
+    rewind(stream);
+
+    if (fstat(fileno(stream), &st) != 0)
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    length = st.st_size;
+    if (length > fmidi_file_size_limit)
+        RET_FAIL(nullptr, fmidi_err_largefile);
+
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[length]);
+    if (!fread(buf.get(), length, 1, stream))
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    fmidi_smf_t *smf = mem_read(buf.get(), length);
+    return smf;
+}
+
+//------------------------------------------------------------------------------
+fmidi_smf_t *fmidi_hmp_mem_read(const uint8_t *data, size_t length)
+{
+    const uint8_t magic[] = {'H', 'M', 'I', 'M', 'I', 'D', 'I', 'P'};
+    const uint8_t newdate[] = {'0', '1', '3', '1', '9', '5'};
+
+    if (length < 0x40 || memcmp(data, magic, sizeof(magic)))
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    size_t trkoffset;
+    if (data[8] == 0)
+        trkoffset = 0x308;
+    else if (!memcmp(data + 8, newdate, sizeof(newdate)))
+        trkoffset = 0x388;
+    else
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    memstream mb(data, length);
+    memstream_status ms;
+
+    uint32_t ntracks;
+    uint32_t division;
+    if ((ms = mb.setpos(0x30)) ||
+        (ms = mb.readintLE(&ntracks, 4)) ||
+        (ms = mb.setpos(0x38)) ||
+        (ms = mb.readintLE(&division, 4)))
+        RET_FAIL(nullptr, (fmidi_status)ms);
+
+    // the division counts units per second
+    if (division < 1 || division > 0x7fff)
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    std::vector<fmidi_hmi_span> spans;
+    spans.reserve(std::min<uint32_t>(ntracks, 256));
+
+    size_t offset = trkoffset;
+    for (uint32_t i = 0; i < ntracks; ++i) {
+        // track header: number, length including header, channel
+        uint32_t tracklen;
+        if (mb.setpos(offset) || mb.skip(4) || mb.readintLE(&tracklen, 4) || mb.skip(4))
+            break;  // file has less tracks than promised, repair
+        if (tracklen < 12)
+            RET_FAIL(nullptr, fmidi_err_format);
+
+        size_t datalen = std::min<size_t>(tracklen - 12, length - mb.getpos());
+        spans.push_back(fmidi_hmi_span{data + mb.getpos(), datalen});
+        offset += tracklen;
+    }
+
+    return fmidi_hmi_read_tracks(
+        spans, fmidi_hmi_variant_hmp, division, 1000000);
+}
+
+fmidi_smf_t *fmidi_hmp_file_read(const char *filename)
+{
+    unique_FILE fh(fmidi_fopen(filename, "rb"));
+    if (!fh)
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    fmidi_smf_t *smf = fmidi_hmp_stream_read(fh.get());
+    return smf;
+}
+
+fmidi_smf_t *fmidi_hmp_stream_read(FILE *stream)
+{
+    return fmidi_hmi_stream_read_variant(stream, &fmidi_hmp_mem_read);
+}
+
+//------------------------------------------------------------------------------
+fmidi_smf_t *fmidi_hmi_mem_read(const uint8_t *data, size_t length)
+{
+    const uint8_t magic[] = {
+        'H', 'M', 'I', '-', 'M', 'I', 'D', 'I', 'S', 'O', 'N', 'G',
+        '0', '6', '1', '5', '9', '5'
+    };
+    const uint8_t trackmagic[] = {
+        'H', 'M', 'I', '-', 'M', 'I', 'D', 'I', 'T', 'R', 'A', 'C', 'K'
+    };
+
+    if (length < sizeof(magic) || memcmp(data, magic, sizeof(magic)))
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    memstream mb(data, length);
+    memstream_status ms;
+
+    uint32_t division;
+    uint32_t ntracks;
+    uint32_t trackdir;
+    if ((ms = mb.setpos(0xd4)) ||
+        (ms = mb.readintLE(&division, 2)) ||
+        (ms = mb.setpos(0xe4)) ||
+        (ms = mb.readintLE(&ntracks, 2)) ||
+        (ms = mb.setpos(0xe8)) ||
+        (ms = mb.readintLE(&trackdir, 4)))
+        RET_FAIL(nullptr, (fmidi_status)ms);
+
+    // the division counts units per second, as in HMP; the file is timed with
+    // a quarter note of 4 seconds, which spans four times the division
+    if (division < 1 || division > 0x7fff / 4)
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    std::vector<fmidi_hmi_span> spans;
+    spans.reserve(std::min<uint32_t>(ntracks, 256));
+
+    for (uint32_t i = 0; i < ntracks; ++i) {
+        uint32_t start;
+        uint32_t end = length;
+        if (mb.setpos(trackdir + 4 * i) || mb.readintLE(&start, 4))
+            break;  // truncated track directory, repair
+        if (i + 1 < ntracks && !mb.readintLE(&end, 4))
+            end = std::min<uint32_t>(end, length);
+        if (start >= end)
+            continue;
+
+        // track header, with the offset of events at 0x57
+        uint32_t evoffset;
+        if (mb.setpos(start) ||
+            !mb.peek(sizeof(trackmagic)) ||
+            memcmp(mb.peek(sizeof(trackmagic)), trackmagic, sizeof(trackmagic)) ||
+            mb.setpos(start + 0x57) ||
+            mb.readintLE(&evoffset, 4))
+            continue;  // invalid track, ignore
+        if (evoffset >= end - start)
+            continue;
+
+        spans.push_back(fmidi_hmi_span{data + start + evoffset, end - start - evoffset});
+    }
+
+    return fmidi_hmi_read_tracks(
+        spans, fmidi_hmi_variant_hmi, division * 4, 4000000);
+}
+
+fmidi_smf_t *fmidi_hmi_file_read(const char *filename)
+{
+    unique_FILE fh(fmidi_fopen(filename, "rb"));
+    if (!fh)
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    fmidi_smf_t *smf = fmidi_hmi_stream_read(fh.get());
+    return smf;
+}
+
+fmidi_smf_t *fmidi_hmi_stream_read(FILE *stream)
+{
+    return fmidi_hmi_stream_read_variant(stream, &fmidi_hmi_mem_read);
+}
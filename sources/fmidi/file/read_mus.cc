@@ -217,10 +217,10 @@ fmidi_smf_t *fmidi_mus_mem_read(const uint8_t *data, size_t length)
     event->datalen = 1;
     event->data[0] = 0x2f;
 
-    uint32_t evdatalen = track.length = evbuf.size();
+    uint32_t evdatalen = evbuf.size();
     uint8_t *evdata = new uint8_t[evdatalen];
-    track.data.reset(evdata);
     memcpy(evdata, evbuf.data(), evdatalen);
+    fmidi_raw_track_assign(track, evdata, evdatalen);
 
     return smf.release();
 }
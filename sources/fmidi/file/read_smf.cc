@@ -8,6 +8,7 @@
 #include "fmidi/fmidi_internal.h"
 #include "fmidi/u_memstream.h"
 #include "fmidi/u_stdio.h"
+#include "fmidi/u_parallel.h"
 #include <vector>
 #include <memory>
 #include <algorithm>
@@ -24,11 +25,84 @@ const fmidi_smf_info_t *fmidi_smf_get_info(const fmidi_smf_t *smf)
 
 double fmidi_smf_compute_duration(const fmidi_smf_t *smf)
 {
-    double duration = 0;
-    fmidi_seq_u seq(fmidi_seq_new(smf));
-    fmidi_seq_event_t sqevt;
-    while (fmidi_seq_next_event(seq.get(), &sqevt))
-        duration = sqevt.time;
+    uint64_t bits = smf->duration.load(std::memory_order_relaxed);
+    double duration;
+    if (bits != ~(uint64_t)0) {
+        memcpy(&duration, &bits, sizeof(double));
+        return duration;
+    }
+
+    const fmidi_smf_info_t *info = &smf->info;
+    unsigned ntracks = info->track_count;
+    bool independent = info->format == 2 && ntracks > 1;
+
+    // the tick of the last event which the sequencer plays, by track, and the
+    // tempo changes with the start offset of the time line, in a same pass
+    std::unique_ptr<uint64_t[]> lastticks(new uint64_t[ntracks]);
+    std::unique_ptr<bool[]> played(new bool[ntracks]);
+    std::unique_ptr<std::vector<fmidi_tempo_segment_t>[]> changes(
+        new std::vector<fmidi_tempo_segment_t>[ntracks]);
+    std::unique_ptr<double[]> starts(new double[ntracks]);
+    auto scan = [&](size_t i) {
+        const fmidi_raw_track &trk = smf->track[i];
+        const uint8_t *evdata = trk.data.get();
+        const uint8_t *evend = evdata + trk.length;
+        uint64_t tick = 0, lasttick = 0;
+        bool any = false, leading = true;
+        fmidi_smpte startoffset;
+        memset(startoffset.code, 0, 5);
+        while (evdata != evend) {
+            const fmidi_event_t *evt = (const fmidi_event_t *)evdata;
+            evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+            tick += evt->delta;
+            leading = leading && tick == 0 && evt->type == fmidi_event_meta;
+            if (evt->type == fmidi_event_meta) {
+                const uint8_t *d = evt->data;
+                if (d[0] == 0x2f || d[0] == 0x3f)  // end of track
+                    break;
+                if (d[0] == 0x51 && evt->datalen == 4) {  // set tempo
+                    uint32_t tempo = (d[1] << 16) | (d[2] << 8) | d[3];
+                    changes[i].push_back(fmidi_tempo_segment_t{tick, 0, tempo});
+                }
+                else if (d[0] == 0x54 && evt->datalen == 6) {  // SMPTE offset
+                    // disregard SMPTE offset for format 1 MIDI and similar
+                    if (independent && leading)
+                        memcpy(startoffset.code, &d[1], 5);
+                }
+            }
+            lasttick = tick;
+            any = true;
+        }
+        lastticks[i] = lasttick;
+        played[i] = any;
+        starts[i] = fmidi_smpte_time(&startoffset);
+    };
+
+    size_t events = 0;
+    for (unsigned i = 0; i < ntracks; ++i)
+        events += fmidi_raw_track_event_count(smf->track[i]);
+    fmidi_parallel_for(ntracks, events, scan);
+
+    // the tempo changes of a time line in order of tracks, as the tempo map
+    if (!independent) {
+        for (unsigned i = 1; i < ntracks; ++i)
+            changes[0].insert(changes[0].end(), changes[i].begin(), changes[i].end());
+    }
+
+    duration = 0;
+    fmidi_tempo_map_u map;
+    for (unsigned i = 0; i < ntracks; ++i) {
+        if (!played[i])
+            continue;
+        if (!map || independent) {
+            unsigned line = independent ? i : 0;
+            map.reset(fmidi_tempo_map_of_changes(info->delta_unit, starts[line], changes[line]));
+        }
+        duration = std::max(duration, fmidi_tempo_map_tick_to_seconds(map.get(), lastticks[i]));
+    }
+
+    memcpy(&bits, &duration, sizeof(double));
+    smf->duration.store(bits, std::memory_order_relaxed);
     return duration;
 }
 
@@ -361,10 +435,10 @@ static bool fmidi_smf_read_contents(fmidi_smf_t *smf, memstream &mb)
             }
         }
 
-        uint32_t evdatalen = trk.length = evbuf.size();
+        uint32_t evdatalen = evbuf.size();
         uint8_t *evdata = new uint8_t[evdatalen];
-        trk.data.reset(evdata);
         memcpy(evdata, evbuf.data(), evdatalen);
+        fmidi_raw_track_assign(trk, evdata, evdatalen);
 
         if (tracklengood)
             mb.setpos(trkoffset + 8 + tracklen);
@@ -232,10 +232,10 @@ static bool fmidi_xmi_read_events(
         event->data[0] = 0x2F;
     }
 
-    uint32_t evdatalen = track.length = evbuf.size();
+    uint32_t evdatalen = evbuf.size();
     uint8_t *evdata = new uint8_t[evdatalen];
-    track.data.reset(evdata);
     memcpy(evdata, evbuf.data(), evdatalen);
+    fmidi_raw_track_assign(track, evdata, evdatalen);
 
     return true;
 }
@@ -4,13 +4,31 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
 #include "fmidi/fmidi_internal.h"
 #include "fmidi/u_stdio.h"
+#include "fmidi/u_parallel.h"
+#include <memory>
+#include <new>
 #include <cstring>
+#include <cstdlib>
 #include <cassert>
+#if !defined(_WIN32)
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
 
-static void write_vlq(uint32_t value, Writer &writer)
+template <class W>
+static void write_vlq(uint32_t value, W &writer)
 {
+    if (value < (1u << 7)) {
+        writer.put(value);
+        return;
+    }
+
     unsigned shift = 28;
     unsigned mask = (1u << 7) - 1;
     while (shift > 0 && ((value >> shift) & mask) == 0)
@@ -22,7 +40,200 @@ static void write_vlq(uint32_t value, Writer &writer)
     writer.put(value & mask);
 }
 
-static bool fmidi_smf_write(const fmidi_smf_t *smf, Writer &writer)
+static bool fmidi_is_channel_message(const fmidi_event_t *event)
+{
+    return event->type == fmidi_event_message &&
+        event->data[0] >= 0x80 && event->data[0] < 0xf0;
+}
+
+static bool fmidi_is_end_of_track(const fmidi_event_t *event)
+{
+    return event->type == fmidi_event_meta &&
+        (event->data[0] == 0x2f || event->data[0] == 0x3f);
+}
+
+template <class W>
+static void fmidi_smf_write_event(
+    const fmidi_event_t *event, uint32_t delta, unsigned flags,
+    int &running_status, W &writer)
+{
+    switch (event->type) {
+    case fmidi_event_meta:
+        write_vlq(delta, writer);
+        writer.put(0xff);
+        writer.put(event->data[0]);
+        write_vlq(event->datalen - 1, writer);
+        writer.write(event->data + 1, event->datalen - 1);
+        running_status = -1;
+        break;
+    case fmidi_event_message:
+    {
+        write_vlq(delta, writer);
+        const uint8_t *data = event->data;
+        uint8_t status = data[0];
+        uint8_t noteon[3];
+        if (status == 0xf0) {
+            writer.put(0xf0);
+            write_vlq(event->datalen - 1, writer);
+            writer.write(data + 1, event->datalen - 1);
+            running_status = -1;
+            break;
+        }
+        if ((flags & fmidi_write_noteoff_as_noteon) &&
+            (status & 0xf0) == 0x80 && event->datalen == 3) {
+            noteon[0] = status = 0x90 | (status & 0x0f);
+            noteon[1] = data[1];
+            noteon[2] = 0;
+            data = noteon;
+        }
+        if ((int)status == running_status)
+            writer.write(data + 1, event->datalen - 1);
+        else {
+            writer.write(data, event->datalen);
+            running_status = status;
+        }
+        break;
+    }
+    case fmidi_event_escape:
+        write_vlq(delta, writer);
+        writer.put(0xf7);
+        write_vlq(event->datalen, writer);
+        writer.write(event->data, event->datalen);
+        running_status = -1;
+        break;
+    case fmidi_event_xmi_timbre:
+    case fmidi_event_xmi_branch_point:
+        break;
+    }
+}
+
+// Writes a same-tick sequence of channel messages grouped by channel, keeping
+// the relative order on each channel, which leaves playback unchanged. The
+// channel of the current running status goes first. The sequence is walked
+// once for each channel it has, which needs no storage.
+template <class W>
+static void fmidi_smf_write_same_tick(
+    const uint8_t *first, const uint8_t *last, uint32_t delta, unsigned flags,
+    int &running_status, W &writer)
+{
+    int running_channel = (running_status >= 0x80 && running_status < 0xf0) ?
+        (running_status & 0x0f) : -1;
+
+    unsigned channels = 0;
+    for (const uint8_t *evdata = first; evdata != last;) {
+        const fmidi_event_t *event = (const fmidi_event_t *)evdata;
+        evdata += fmidi_event_pad(fmidi_event_sizeof(event->datalen));
+        channels |= 1u << (event->data[0] & 0x0f);
+    }
+
+    for (int i = -1; i < 16; ++i) {
+        int channel = (i == -1) ? running_channel : i;
+        if (channel == -1 || (i != -1 && channel == running_channel) ||
+            !(channels & (1u << channel)))
+            continue;
+        for (const uint8_t *evdata = first; evdata != last;) {
+            const fmidi_event_t *event = (const fmidi_event_t *)evdata;
+            evdata += fmidi_event_pad(fmidi_event_sizeof(event->datalen));
+            if ((event->data[0] & 0x0f) == channel) {
+                fmidi_smf_write_event(event, delta, flags, running_status, writer);
+                delta = 0;
+            }
+        }
+    }
+}
+
+template <class W>
+static void fmidi_smf_write_events(
+    const fmidi_smf_t *smf, unsigned track, unsigned flags, W &writer)
+{
+    int running_status = -1;
+    uint32_t pending_delta = 0;  // time of events which have no encoding
+
+    const fmidi_raw_track &trk = smf->track[track];
+    const uint8_t *evdata = trk.data.get();
+    const uint8_t *evend = evdata + trk.length;
+
+    while (evdata != evend) {
+        const fmidi_event_t *event = (const fmidi_event_t *)evdata;
+        evdata += fmidi_event_pad(fmidi_event_sizeof(event->datalen));
+
+        if (event->type == fmidi_event_xmi_timbre ||
+            event->type == fmidi_event_xmi_branch_point) {
+            pending_delta += event->delta;
+            continue;
+        }
+
+        uint32_t delta = pending_delta + event->delta;
+        pending_delta = 0;
+
+        if ((flags & fmidi_write_trim_track_end) && fmidi_is_end_of_track(event)) {
+            // the sequence ends at the last event, the final delta is ignored
+            fmidi_smf_write_event(event, 0, flags, running_status, writer);
+            break;
+        }
+
+        if ((flags & fmidi_write_group_same_tick) && fmidi_is_channel_message(event)) {
+            const uint8_t *first = (const uint8_t *)event;
+            while (evdata != evend) {
+                const fmidi_event_t *next = (const fmidi_event_t *)evdata;
+                if (next->delta != 0 || !fmidi_is_channel_message(next))
+                    break;
+                evdata += fmidi_event_pad(fmidi_event_sizeof(next->datalen));
+            }
+            fmidi_smf_write_same_tick(first, evdata, delta, flags, running_status, writer);
+            continue;
+        }
+
+        fmidi_smf_write_event(event, delta, flags, running_status, writer);
+    }
+}
+
+static uint32_t fmidi_smf_track_encoded_size(
+    const fmidi_smf_t *smf, unsigned track, unsigned flags)
+{
+    Counting_Writer counter;
+    fmidi_smf_write_events(smf, track, flags, counter);
+    return counter.count();
+}
+
+static size_t fmidi_smf_file_encoded_size(
+    const fmidi_smf_t *smf, unsigned flags, uint32_t *track_sizes)
+{
+    const fmidi_smf_info_t *info = fmidi_smf_get_info(smf);
+    unsigned track_count = info->track_count;
+
+    // without storage for the sizes, they are computed serially
+    std::unique_ptr<uint32_t[]> local_track_sizes;
+    if ((flags & fmidi_write_parallel) && !track_sizes) {
+        local_track_sizes.reset(new (std::nothrow) uint32_t[track_count]);
+        track_sizes = local_track_sizes.get();
+        if (!track_sizes)
+            flags &= ~fmidi_write_parallel;
+    }
+
+    if (flags & fmidi_write_parallel) {
+        fmidi_parallel_for(track_count, [smf, flags, track_sizes](size_t i) {
+            track_sizes[i] = fmidi_smf_track_encoded_size(smf, i, flags);
+        });
+    }
+
+    size_t size = 14;
+    for (unsigned i = 0; i < track_count; ++i) {
+        uint32_t track_size;
+        if (flags & fmidi_write_parallel)
+            track_size = track_sizes[i];
+        else {
+            track_size = fmidi_smf_track_encoded_size(smf, i, flags);
+            if (track_sizes)
+                track_sizes[i] = track_size;
+        }
+        size += 8 + track_size;
+    }
+    return size;
+}
+
+template <class W>
+static void fmidi_smf_write_header(const fmidi_smf_t *smf, W &writer)
 {
     writer.write("MThd", 4);
 
@@ -34,113 +245,278 @@ static bool fmidi_smf_write(const fmidi_smf_t *smf, Writer &writer)
     writer.writeBE(&info->format, 2);
     writer.writeBE(&track_count, 2);
     writer.writeBE(&info->delta_unit, 2);
+}
+
+template <class W>
+static void fmidi_smf_write_track(
+    const fmidi_smf_t *smf, unsigned track, unsigned flags, W &writer,
+    uint32_t track_length)
+{
+    writer.write("MTrk", 4);
+    writer.writeBE(&track_length, 4);
+    fmidi_smf_write_events(smf, track, flags, writer);
+}
+
+template <class W>
+static bool fmidi_smf_write(
+    const fmidi_smf_t *smf, unsigned flags, W &writer,
+    const uint32_t *track_sizes = nullptr)
+{
+    fmidi_smf_write_header(smf, writer);
 
+    unsigned track_count = fmidi_smf_get_info(smf)->track_count;
     for (unsigned i = 0; i < track_count; ++i) {
-        writer.write("MTrk", 4);
-
-        off_t off_track_length = writer.tell();
-
-        uint32_t track_length = 0;
-        writer.writeBE(&track_length, 4);
-
-        int running_status = -1;
-
-        fmidi_track_iter_t iter;
-        fmidi_smf_track_begin(&iter, i);
-
-        const fmidi_event_t *event;
-        while ((event = fmidi_smf_track_next(smf, &iter))) {
-            switch (event->type) {
-            case fmidi_event_meta:
-                write_vlq(event->delta, writer);
-                writer.put(0xff);
-                writer.put(event->data[0]);
-                write_vlq(event->datalen - 1, writer);
-                writer.write(event->data + 1, event->datalen - 1);
-                running_status = -1;
-                break;
-            case fmidi_event_message:
-            {
-                write_vlq(event->delta, writer);
-                uint8_t status = event->data[0];
-                if (status == 0xf0) {
-                    writer.put(0xf0);
-                    write_vlq(event->datalen - 1, writer);
-                    writer.write(event->data + 1, event->datalen - 1);
-                    running_status = -1;
-                }
-                else if ((int)status == running_status)
-                    writer.write(event->data + 1, event->datalen - 1);
-                else {
-                    writer.write(event->data, event->datalen);
-                    running_status = status;
-                }
-                break;
-            }
-            case fmidi_event_escape:
-                write_vlq(event->delta, writer);
-                writer.put(0xf7);
-                write_vlq(event->datalen, writer);
-                writer.write(event->data, event->datalen);
-                running_status = -1;
-                break;
-            case fmidi_event_xmi_timbre:
-            case fmidi_event_xmi_branch_point:
-                break;
-            }
-        }
+        // a size pass first, so the output never needs to seek back
+        uint32_t track_length = track_sizes ? track_sizes[i] :
+            fmidi_smf_track_encoded_size(smf, i, flags);
+        fmidi_smf_write_track(smf, i, flags, writer, track_length);
+    }
 
-        off_t off_track_end = writer.tell();
+    return true;
+}
 
-        track_length =
-            std::make_unsigned<off_t>::type(off_track_end) -
-            std::make_unsigned<off_t>::type(off_track_length) - 4;
+// Encodes into memory of the size computed with fmidi_smf_file_encoded_size.
+// In parallel mode, each track is encoded by a worker at its final offset.
+static bool fmidi_smf_mem_encode(
+    const fmidi_smf_t *smf, unsigned flags, uint8_t *mem,
+    const uint32_t *track_sizes)
+{
+    unsigned track_count = fmidi_smf_get_info(smf)->track_count;
+    std::unique_ptr<size_t[]> track_offsets;
+    if (flags & fmidi_write_parallel)
+        track_offsets.reset(new (std::nothrow) size_t[track_count]);
 
-        writer.seek(off_track_length, SEEK_SET);
-        writer.writeBE(&track_length, 4);
-        writer.seek(off_track_end, SEEK_SET);
+    // without storage for the offsets, the tracks are encoded serially
+    if (!track_offsets) {
+        Memory_Writer writer(mem);
+        return fmidi_smf_write(smf, flags, writer, track_sizes);
     }
 
+    size_t offset = 14;
+    for (unsigned i = 0; i < track_count; ++i) {
+        track_offsets[i] = offset;
+        offset += 8 + track_sizes[i];
+    }
+
+    Memory_Writer writer(mem);
+    fmidi_smf_write_header(smf, writer);
+
+    const size_t *offsets = track_offsets.get();
+    fmidi_parallel_for(track_count, [smf, flags, mem, track_sizes, offsets](size_t i) {
+        Memory_Writer writer(mem + offsets[i]);
+        fmidi_smf_write_track(smf, i, flags, writer, track_sizes[i]);
+    });
+
     return true;
 }
 
-bool fmidi_smf_mem_write(const fmidi_smf_t *smf, uint8_t **data, size_t *length)
+size_t fmidi_smf_encoded_size(const fmidi_smf_t *smf)
 {
-    std::vector<uint8_t> mem;
-    mem.reserve(8192);
+    return fmidi_smf_encoded_size_ex(smf, 0);
+}
 
-    Memory_Writer writer(mem);
-    if (!fmidi_smf_write(smf, writer))
-        return false;
+size_t fmidi_smf_encoded_size_ex(const fmidi_smf_t *smf, unsigned flags)
+{
+    return fmidi_smf_file_encoded_size(smf, flags, nullptr);
+}
+
+size_t fmidi_smf_encoded_savings(const fmidi_smf_t *smf, unsigned flags)
+{
+    size_t standard = fmidi_smf_file_encoded_size(smf, 0, nullptr);
+    size_t encoded = fmidi_smf_file_encoded_size(smf, flags, nullptr);
+    return (encoded < standard) ? (standard - encoded) : 0;
+}
+
+bool fmidi_smf_mem_write(const fmidi_smf_t *smf, uint8_t **data, size_t *length)
+{
+    return fmidi_smf_mem_write_ex(smf, data, length, 0);
+}
 
+bool fmidi_smf_mem_write_ex(
+    const fmidi_smf_t *smf, uint8_t **data, size_t *length, unsigned flags)
+{
     assert(data);
     assert(length);
 
-    if (!(*data = (uint8_t *)malloc(mem.size())))
-        throw std::bad_alloc();
+    uint16_t track_count = fmidi_smf_get_info(smf)->track_count;
+    std::unique_ptr<uint32_t[]> track_sizes(new (std::nothrow) uint32_t[track_count]);
+    if (!track_sizes)
+        RET_FAIL(false, fmidi_err_output);
+    size_t size = fmidi_smf_file_encoded_size(smf, flags, track_sizes.get());
 
-    memcpy(*data, mem.data(), mem.size());
-    *length = mem.size();
+    uint8_t *mem = (uint8_t *)malloc(size);
+    if (!mem)
+        RET_FAIL(false, fmidi_err_output);
+
+    if (!fmidi_smf_mem_encode(smf, flags, mem, track_sizes.get())) {
+        free(mem);
+        return false;
+    }
+
+    *data = mem;
+    *length = size;
 
     return true;
 }
 
+size_t fmidi_smf_mem_write_into(const fmidi_smf_t *smf, uint8_t *data, size_t capacity)
+{
+    return fmidi_smf_mem_write_into_ex(smf, data, capacity, 0);
+}
+
+size_t fmidi_smf_mem_write_into_ex(
+    const fmidi_smf_t *smf, uint8_t *data, size_t capacity, unsigned flags)
+{
+    uint16_t track_count = fmidi_smf_get_info(smf)->track_count;
+    std::unique_ptr<uint32_t[]> track_sizes(new (std::nothrow) uint32_t[track_count]);
+    if (!track_sizes)
+        RET_FAIL(0, fmidi_err_output);
+    size_t size = fmidi_smf_file_encoded_size(smf, flags, track_sizes.get());
+
+    if (size > capacity)
+        RET_FAIL(0, fmidi_err_output);
+
+    if (!fmidi_smf_mem_encode(smf, flags, data, track_sizes.get()))
+        return 0;
+
+    return size;
+}
+
 bool fmidi_smf_file_write(const fmidi_smf_t *smf, const char *filename)
+{
+    return fmidi_smf_file_write_ex(smf, filename, 0);
+}
+
+#if !defined(_WIN32)
+// Encodes directly into a mapping of the file, sized in advance.
+// Returns -1 if the file is not suitable, and the stream should be used.
+static int fmidi_smf_mmap_write(
+    const fmidi_smf_t *smf, const char *filename, FILE *stream, unsigned flags)
+{
+    struct stat st;
+    if (fstat(fileno(stream), &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+
+    // a shared mapping needs read access, reopen the same file for it
+    int fd = open(filename, O_RDWR);
+    if (fd == -1)
+        return -1;
+    std::unique_ptr<int, void (*)(int *)> fd_u(&fd, [](int *fd) { close(*fd); });
+
+    struct stat st2;
+    if (fstat(fd, &st2) != 0 || st.st_dev != st2.st_dev || st.st_ino != st2.st_ino)
+        return -1;
+
+    uint16_t track_count = fmidi_smf_get_info(smf)->track_count;
+    std::unique_ptr<uint32_t[]> track_sizes(new (std::nothrow) uint32_t[track_count]);
+    if (!track_sizes)
+        RET_FAIL(0, fmidi_err_output);
+    size_t size = fmidi_smf_file_encoded_size(smf, flags, track_sizes.get());
+
+    // reserve the blocks, so a full disk is an error and not SIGBUS later
+#if defined(__linux__)
+    int err = posix_fallocate(fd, 0, size);
+    if (err == ENOSPC || err == EFBIG)
+        RET_FAIL(0, fmidi_err_output);
+    if (err != 0 && ftruncate(fd, size) != 0)
+        RET_FAIL(0, fmidi_err_output);
+#else
+    if (ftruncate(fd, size) != 0)
+        RET_FAIL(0, fmidi_err_output);
+#endif
+
+    void *mem = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        if (ftruncate(fd, 0) != 0)
+            RET_FAIL(0, fmidi_err_output);
+        return -1;
+    }
+
+    bool success = fmidi_smf_mem_encode(smf, flags, (uint8_t *)mem, track_sizes.get());
+    if (munmap(mem, size) != 0)
+        success = false;
+    if (!success)
+        RET_FAIL(0, fmidi_err_output);
+
+    return 1;
+}
+#endif
+
+bool fmidi_smf_file_write_ex(
+    const fmidi_smf_t *smf, const char *filename, unsigned flags)
 {
     unique_FILE fh(fmidi_fopen(filename, "wb"));
     if (!fh)
         RET_FAIL(false, fmidi_err_output);
 
-    return fmidi_smf_stream_write(smf, fh.get());
+#if !defined(_WIN32)
+    int ret = fmidi_smf_mmap_write(smf, filename, fh.get(), flags);
+    if (ret != -1) {
+        if (ret == 1 && fclose(fh.release()) != 0)
+            RET_FAIL(false, fmidi_err_output);
+        return ret == 1;
+    }
+#endif
+
+    return fmidi_smf_stream_write_ex(smf, fh.get(), flags);
 }
 
 bool fmidi_smf_stream_write(const fmidi_smf_t *smf, FILE *stream)
 {
+    return fmidi_smf_stream_write_ex(smf, stream, 0);
+}
+
+bool fmidi_smf_stream_write_ex(
+    const fmidi_smf_t *smf, FILE *stream, unsigned flags)
+{
+    if (flags & fmidi_write_parallel) {
+        // encode in memory with the workers, then output sequentially
+        uint8_t *data;
+        size_t length;
+        if (!fmidi_smf_mem_write_ex(smf, &data, &length, flags))
+            return false;
+        std::unique_ptr<uint8_t[], void (*)(void *)> data_u(data, &free);
+        if (fwrite(data, 1, length, stream) != length || fflush(stream) != 0)
+            RET_FAIL(false, fmidi_err_output);
+        return true;
+    }
+
     Stream_Writer writer(stream);
-    if (!fmidi_smf_write(smf, writer))
+    if (!fmidi_smf_write(smf, flags, writer))
+        return false;
+
+    if (!writer.flush() || fflush(stream) != 0)
+        RET_FAIL(false, fmidi_err_output);
+
+    return true;
+}
+
+bool fmidi_smf_callback_write(
+    const fmidi_smf_t *smf, bool (*sink)(const uint8_t *, size_t, void *), void *cookie)
+{
+    return fmidi_smf_callback_write_ex(smf, sink, cookie, 0);
+}
+
+bool fmidi_smf_callback_write_ex(
+    const fmidi_smf_t *smf, bool (*sink)(const uint8_t *, size_t, void *), void *cookie,
+    unsigned flags)
+{
+    if (flags & fmidi_write_parallel) {
+        uint8_t *data;
+        size_t length;
+        if (!fmidi_smf_mem_write_ex(smf, &data, &length, flags))
+            return false;
+        std::unique_ptr<uint8_t[], void (*)(void *)> data_u(data, &free);
+        if (!sink(data, length, cookie))
+            RET_FAIL(false, fmidi_err_output);
+        return true;
+    }
+
+    Callback_Writer writer(Callback_Sink(sink, cookie));
+    if (!fmidi_smf_write(smf, flags, writer))
         return false;
 
-    if (fflush(stream) != 0)
+    if (!writer.flush())
         RET_FAIL(false, fmidi_err_output);
 
     return true;
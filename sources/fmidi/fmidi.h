@@ -48,6 +48,7 @@ typedef struct fmidi_smf_info {
 } fmidi_smf_info_t;
 
 FMIDI_API const fmidi_smf_info_t *fmidi_smf_get_info(const fmidi_smf_t *smf);
+// computes the time of the last event played, and keeps it until modified
 FMIDI_API double fmidi_smf_compute_duration(const fmidi_smf_t *smf);
 
 ////////////
@@ -58,6 +59,41 @@ FMIDI_API bool fmidi_smf_mem_write(const fmidi_smf_t *smf, uint8_t **data, size_
 FMIDI_API bool fmidi_smf_file_write(const fmidi_smf_t *smf, const char *filename);
 FMIDI_API bool fmidi_smf_stream_write(const fmidi_smf_t *smf, FILE *stream);
 
+FMIDI_API size_t fmidi_smf_encoded_size(const fmidi_smf_t *smf);
+// returns the size written, or 0 on failure or if the capacity is insufficient
+FMIDI_API size_t fmidi_smf_mem_write_into(const fmidi_smf_t *smf, uint8_t *data, size_t capacity);
+
+typedef enum fmidi_write_flag {
+    // note-off as note-on with velocity 0, discarding the release velocity
+    fmidi_write_noteoff_as_noteon = 1 << 0,
+    // group same-tick channel messages by channel, for longer running status
+    fmidi_write_group_same_tick = 1 << 1,
+    // end of track at the last event, which is the end of playback, and drop
+    // the events past it
+    fmidi_write_trim_track_end = 1 << 2,
+    fmidi_write_compact =
+        fmidi_write_noteoff_as_noteon |
+        fmidi_write_group_same_tick |
+        fmidi_write_trim_track_end,
+    // encode the tracks concurrently, the output is identical
+    fmidi_write_parallel = 1 << 3,
+} fmidi_write_flag_t;
+
+FMIDI_API size_t fmidi_smf_encoded_size_ex(const fmidi_smf_t *smf, unsigned flags);
+// returns the bytes which the flags save over the standard encoding
+FMIDI_API size_t fmidi_smf_encoded_savings(const fmidi_smf_t *smf, unsigned flags);
+FMIDI_API bool fmidi_smf_mem_write_ex(const fmidi_smf_t *smf, uint8_t **data, size_t *length, unsigned flags);
+FMIDI_API size_t fmidi_smf_mem_write_into_ex(const fmidi_smf_t *smf, uint8_t *data, size_t capacity, unsigned flags);
+FMIDI_API bool fmidi_smf_file_write_ex(const fmidi_smf_t *smf, const char *filename, unsigned flags);
+FMIDI_API bool fmidi_smf_stream_write_ex(const fmidi_smf_t *smf, FILE *stream, unsigned flags);
+
+// delivers the output in sequence to a sink, which returns false to abort
+FMIDI_API bool fmidi_smf_callback_write(
+    const fmidi_smf_t *smf, bool (*sink)(const uint8_t *, size_t, void *), void *cookie);
+FMIDI_API bool fmidi_smf_callback_write_ex(
+    const fmidi_smf_t *smf, bool (*sink)(const uint8_t *, size_t, void *), void *cookie,
+    unsigned flags);
+
 ////////////////////
 // IDENTIFICATION //
 ////////////////////
@@ -66,6 +102,8 @@ typedef enum fmidi_fileformat {
     fmidi_fileformat_smf,
     fmidi_fileformat_xmi,
     fmidi_fileformat_mus,
+    fmidi_fileformat_hmp,
+    fmidi_fileformat_hmi,
 } fmidi_fileformat_t;
 
 FMIDI_API fmidi_fileformat_t fmidi_mem_identify(const uint8_t *data, size_t length);
@@ -110,6 +148,129 @@ FMIDI_API void fmidi_smf_track_begin(fmidi_track_iter_t *it, uint16_t track);
 FMIDI_API const fmidi_event_t *fmidi_smf_track_next(
     const fmidi_smf_t *smf, fmidi_track_iter_t *it);
 
+/////////////
+// EDITING //
+/////////////
+
+// Merges the tracks into a single track of format 0. Events of the same tick
+// come in order of track, then in the order of their track. Each track ends
+// at its end-of-track, and the merged track ends with the last track to end.
+// Only a SMPTE offset at the start is kept, the first one.
+// A format 2 file fails, unless it has a single track.
+FMIDI_API fmidi_smf_t *fmidi_smf_merge(const fmidi_smf_t *smf);
+
+typedef struct fmidi_smf_builder fmidi_smf_builder_t;
+
+typedef struct fmidi_builder_event {
+    uint64_t tick;
+    fmidi_event_type_t type;
+    const uint8_t *data;
+    uint32_t datalen;
+} fmidi_builder_event_t;
+
+// The event data is laid out as in fmidi_event_t. A message which has no
+// encoding in a file is invalid input.
+FMIDI_API fmidi_smf_builder_t *fmidi_smf_builder_new(uint16_t format, uint16_t delta_unit);
+FMIDI_API void fmidi_smf_builder_free(fmidi_smf_builder_t *bld);
+// returns the index of the new track, or -1 on failure
+FMIDI_API int fmidi_smf_builder_add_track(fmidi_smf_builder_t *bld);
+FMIDI_API bool fmidi_smf_builder_append(
+    fmidi_smf_builder_t *bld, uint16_t track, fmidi_event_type_t type,
+    uint32_t delta, const uint8_t *data, uint32_t datalen);
+// appends at an absolute tick, not earlier than the last event of the track
+FMIDI_API bool fmidi_smf_builder_append_at(
+    fmidi_smf_builder_t *bld, uint16_t track, fmidi_event_type_t type,
+    uint64_t tick, const uint8_t *data, uint32_t datalen);
+// inserts events sorted by tick, after the existing events of the same tick
+FMIDI_API bool fmidi_smf_builder_insert(
+    fmidi_smf_builder_t *bld, uint16_t track,
+    const fmidi_builder_event_t *events, size_t count);
+// moves the contents into a new file, ending the tracks which are not ended,
+// and leaves the builder empty
+FMIDI_API fmidi_smf_t *fmidi_smf_builder_finish(fmidi_smf_builder_t *bld);
+
+// Creates a file which shares the tracks of another. The track storage is
+// reference-counted, and it is copied only when modified.
+FMIDI_API fmidi_smf_t *fmidi_smf_derive(const fmidi_smf_t *smf);
+// replaces a track with a track of another file, shared without copy
+FMIDI_API bool fmidi_smf_share_track(
+    fmidi_smf_t *dst, uint16_t dsttrack, const fmidi_smf_t *src, uint16_t srctrack);
+// like fmidi_smf_track_next, but the event is modifiable in place
+// the size of the event data must be preserved
+FMIDI_API fmidi_event_t *fmidi_smf_track_next_mutable(
+    fmidi_smf_t *smf, fmidi_track_iter_t *it);
+
+typedef enum fmidi_rounding {
+    fmidi_round_nearest,
+    fmidi_round_down,
+    fmidi_round_up,
+} fmidi_rounding_t;
+
+// Converts the file to another delta unit, metrical or SMPTE. The positions
+// are rounded from the exact times, so the error is at most one unit and it
+// does not accumulate. From metrical to SMPTE, the times follow the tempo.
+// From SMPTE to metrical, the tempo events are replaced with a fixed tempo.
+// SMPTE 29 is 30 drop-frame, which has 30000 frames in 1001 seconds.
+FMIDI_API fmidi_smf_t *fmidi_smf_resample(
+    const fmidi_smf_t *smf, uint16_t delta_unit, fmidi_rounding_t rounding);
+
+// The optimizer removes the channel messages which have no audible effect.
+// It models a device on each port, which receives the events of all tracks,
+// or of each track in format 2. Their initial state is unknown, and so it is
+// after a system exclusive. A key is either on or off, so a note-on has no
+// effect on a key already on. Data entry, (N)RPN selection and channel mode
+// messages are kept.
+typedef enum fmidi_optimize_flag {
+    // controller set to its current value
+    fmidi_optimize_redundant_controllers = 1 << 0,
+    // pitch bend set to its current value
+    fmidi_optimize_redundant_pitch_bend = 1 << 1,
+    // channel pressure set to its current value
+    fmidi_optimize_redundant_pressure = 1 << 2,
+    // program change to the current program, without bank select since
+    fmidi_optimize_redundant_programs = 1 << 3,
+    // note-on of a key on, note-off of a key off
+    fmidi_optimize_redundant_notes = 1 << 4,
+    // note-on and note-off at the same tick, with sustain known to be off,
+    // except on channel 10; the note-off is kept if the key was maybe on
+    fmidi_optimize_empty_notes = 1 << 5,
+    // system exclusive repeated immediately at the same tick
+    fmidi_optimize_repeated_sysex = 1 << 6,
+    fmidi_optimize_all = (1 << 7) - 1,
+} fmidi_optimize_flag_t;
+
+typedef struct fmidi_optimize_report {
+    size_t events;
+    size_t total;
+    size_t controllers;
+    size_t pitch_bends;
+    size_t pressure;
+    size_t programs;
+    size_t notes;
+    size_t empty_notes;
+    size_t sysex;
+} fmidi_optimize_report_t;
+
+// returns the optimized file, and fills the report of removed events if given
+FMIDI_API fmidi_smf_t *fmidi_smf_optimize(
+    const fmidi_smf_t *smf, unsigned flags, fmidi_optimize_report_t *report);
+
+// The canonical form is the same for files which differ only in the layout of
+// tracks, in their numbering, in the order of simultaneous channel messages of
+// different channels, or in the encoding. The tracks are merged, except in
+// format 2, where each is kept. At a tick, the events of each track keep their
+// order of playback, and the tracks follow in order of their contents; then
+// the channel messages between two other events are ordered by channel,
+// keeping the order within a channel. A note-on of null velocity
+// becomes a note-off of velocity 64. XMI events, which have no standard
+// encoding, are dropped.
+FMIDI_API fmidi_smf_t *fmidi_smf_canonicalize(const fmidi_smf_t *smf);
+// Computes the MurmurHash3 x64 128 of the canonical form, without building
+// it. The hashed data are the format, track count and delta unit in 16-bit big
+// endian, then the events of each track in file encoding, without running
+// status. This definition does not change between versions.
+FMIDI_API void fmidi_smf_hash(const fmidi_smf_t *smf, uint8_t digest[16]);
+
 /////////////
 // FORMATS //
 /////////////
@@ -122,6 +283,14 @@ FMIDI_API fmidi_smf_t *fmidi_mus_mem_read(const uint8_t *data, size_t length);
 FMIDI_API fmidi_smf_t *fmidi_mus_file_read(const char *filename);
 FMIDI_API fmidi_smf_t *fmidi_mus_stream_read(FILE *stream);
 
+FMIDI_API fmidi_smf_t *fmidi_hmp_mem_read(const uint8_t *data, size_t length);
+FMIDI_API fmidi_smf_t *fmidi_hmp_file_read(const char *filename);
+FMIDI_API fmidi_smf_t *fmidi_hmp_stream_read(FILE *stream);
+
+FMIDI_API fmidi_smf_t *fmidi_hmi_mem_read(const uint8_t *data, size_t length);
+FMIDI_API fmidi_smf_t *fmidi_hmi_file_read(const char *filename);
+FMIDI_API fmidi_smf_t *fmidi_hmi_stream_read(FILE *stream);
+
 ///////////////
 // SEQUENCER //
 ///////////////
@@ -132,6 +301,8 @@ typedef struct fmidi_seq_event {
     double time;
     uint16_t track;
     const fmidi_event_t *event;
+    // the position in delta units, from the start of the track
+    uint64_t tick;
 } fmidi_seq_event_t;
 
 FMIDI_API fmidi_seq_t *fmidi_seq_new(const fmidi_smf_t *smf);
@@ -139,6 +310,106 @@ FMIDI_API void fmidi_seq_free(fmidi_seq_t *pl);
 FMIDI_API void fmidi_seq_rewind(fmidi_seq_t *pl);
 FMIDI_API bool fmidi_seq_peek_event(fmidi_seq_t *pl, fmidi_seq_event_t *plevt);
 FMIDI_API bool fmidi_seq_next_event(fmidi_seq_t *pl, fmidi_seq_event_t *plevt);
+// gets the next events which are earlier than the time, at most the given
+// count, and returns the count obtained
+FMIDI_API size_t fmidi_seq_next_events(
+    fmidi_seq_t *pl, fmidi_seq_event_t *plevts, size_t max, double until);
+// Moves to the first event at the time or later. Once it has seeked, the
+// sequencer saves its state at intervals of events as it plays from the start,
+// and a seek resumes from the nearest saved state. The first seek allocates
+// the storage of all the states, and playback does not allocate afterwards.
+FMIDI_API void fmidi_seq_seek(fmidi_seq_t *pl, double time);
+
+// conventions of loop points, combined as flags
+typedef enum fmidi_loop_convention {
+    // controller 111 at the loop start, the loop ends with the song (RPG Maker)
+    fmidi_loop_cc111 = 1,
+    // text or marker "loopStart", and optionally "loopEnd", ignoring case
+    fmidi_loop_markers = 2,
+} fmidi_loop_convention_t;
+
+// the loop, from the first tick to the last tick inclusive
+typedef struct fmidi_loop {
+    uint64_t start;
+    uint64_t end;
+} fmidi_loop_t;
+
+// Finds the loop by the given conventions, markers first. The files of format
+// 2 with independent tracks have no loop.
+FMIDI_API bool fmidi_smf_find_loop(
+    const fmidi_smf_t *smf, unsigned conventions, fmidi_loop_t *loop);
+// Makes the sequencer play the loop endlessly, or stop looping if null, and
+// rewinds it. The state at the loop start is saved here, and the sequencer
+// resumes it after the loop end, with times which continue to increase.
+FMIDI_API bool fmidi_seq_set_loop(fmidi_seq_t *pl, const fmidi_loop_t *loop);
+// Jumps the track to the XMI branch point of the given id, which then plays at
+// the time of the last event played, the events after it keeping their
+// timing. The notes which the track has on are released first, by note-offs
+// which the sequencer plays at that time. The track must have its own time
+// line, as in format 2. The first branch indexes the branch points, which
+// makes the later ones cheap. A seek leaves the branches and returns to the
+// sequence of the file.
+FMIDI_API bool fmidi_seq_branch(fmidi_seq_t *pl, uint16_t track, uint8_t id);
+
+///////////////
+// TEMPO MAP //
+///////////////
+
+// The tempo map converts between ticks and seconds on a time line, as the
+// sequencer times it. The tracks share a time line, except in format 2 where
+// each track has its own, which starts at its SMPTE offset.
+typedef struct fmidi_tempo_map fmidi_tempo_map_t;
+
+// a span of constant tempo, from the given tick until the next segment
+typedef struct fmidi_tempo_segment {
+    uint64_t tick;
+    double time;
+    uint32_t tempo;
+} fmidi_tempo_segment_t;
+
+// the track selects the time line in format 2, it is ignored otherwise
+FMIDI_API fmidi_tempo_map_t *fmidi_tempo_map_new(const fmidi_smf_t *smf, uint16_t track);
+FMIDI_API void fmidi_tempo_map_free(fmidi_tempo_map_t *map);
+// gets the segments in order of tick, the first at tick 0
+FMIDI_API const fmidi_tempo_segment_t *fmidi_tempo_map_segments(
+    const fmidi_tempo_map_t *map, size_t *count);
+FMIDI_API double fmidi_tempo_map_tick_to_seconds(const fmidi_tempo_map_t *map, uint64_t tick);
+// returns a fractional tick, 0 for times before the start
+FMIDI_API double fmidi_tempo_map_seconds_to_tick(const fmidi_tempo_map_t *map, double time);
+FMIDI_API uint32_t fmidi_tempo_map_tempo_at(const fmidi_tempo_map_t *map, uint64_t tick);
+
+//////////////
+// TIMELINE //
+//////////////
+
+// The timeline holds the events of all tracks, merged in playback order, for
+// files which are played or analysed repeatedly. It refers to the events of
+// the file, which must persist unmodified as long as the timeline is used.
+typedef struct fmidi_timeline fmidi_timeline_t;
+
+typedef struct fmidi_timeline_entry {
+    // the time in microseconds, as the sequencer times the event
+    uint64_t time;
+    // the position in delta units, from the start of the track
+    uint64_t tick;
+    uint16_t track;
+    const fmidi_event_t *event;
+} fmidi_timeline_entry_t;
+
+FMIDI_API fmidi_timeline_t *fmidi_timeline_new(const fmidi_smf_t *smf);
+FMIDI_API void fmidi_timeline_free(fmidi_timeline_t *tl);
+// gets the entries in order of time, then tick, then track, as the sequencer
+// plays them; independent tracks of format 2 are ordered by time, then track
+FMIDI_API const fmidi_timeline_entry_t *fmidi_timeline_entries(
+    const fmidi_timeline_t *tl, size_t *count);
+// returns the index of the first entry at the time or later, in microseconds
+FMIDI_API size_t fmidi_timeline_find(const fmidi_timeline_t *tl, uint64_t time);
+// Saves the timeline to memory, to store it along with an image of the file.
+// The data identify the file, and reading them back with another file fails.
+FMIDI_API bool fmidi_timeline_mem_write(
+    const fmidi_timeline_t *tl, uint8_t **data, size_t *length);
+FMIDI_API fmidi_timeline_t *fmidi_timeline_mem_read(
+    const fmidi_smf_t *smf, const uint8_t *data, size_t length);
 
 /////////////
 // UTILITY //
@@ -198,6 +469,45 @@ FMIDI_API void fmidi_player_event_callback(
 FMIDI_API void fmidi_player_finish_callback(
     fmidi_player_t *seq, void (*cbfn)(void *), void *cbdata);
 
+// an event of a block of audio, at the offset of its frame in the block
+typedef struct fmidi_player_block_event {
+    uint32_t frame;
+    const fmidi_event_t *event;
+} fmidi_player_block_event_t;
+
+// Plays the next block of frames at the sample rate, and gets the events of
+// the block, without calling the event callback. The frame position carries
+// over successive blocks, without drift. If the count obtained reaches the
+// maximum, the block is incomplete, and the next call resumes it, ignoring its
+// frame count. This does not allocate, for use in an audio thread.
+FMIDI_API size_t fmidi_player_render_block(
+    fmidi_player_t *seq, double sample_rate, uint32_t frames,
+    fmidi_player_block_event_t *events, size_t max);
+
+//////////////
+// RECORDER //
+//////////////
+
+// Records live messages into a file of format 0. The messages are pushed from
+// a real-time thread into a buffer of fixed capacity, and they are collected
+// by another thread, which owns the other functions.
+typedef struct fmidi_recorder fmidi_recorder_t;
+FMIDI_API fmidi_recorder_t *fmidi_recorder_new(uint16_t delta_unit, uint32_t tempo, size_t capacity);
+FMIDI_API void fmidi_recorder_free(fmidi_recorder_t *rec);
+// Pushes a message, with its time in seconds since the start of recording.
+// It does not allocate or lock. It fails if the buffer is full, or if the
+// message is neither a channel message of the length of its status nor a
+// system exclusive ending with f7; system common and real-time messages are
+// not recorded.
+FMIDI_API bool fmidi_recorder_push(
+    fmidi_recorder_t *rec, double time, const uint8_t *data, uint32_t datalen);
+// collects the pushed messages, returns their count
+FMIDI_API size_t fmidi_recorder_drain(fmidi_recorder_t *rec);
+// returns a file of the messages recorded so far
+FMIDI_API fmidi_smf_t *fmidi_recorder_snapshot(fmidi_recorder_t *rec);
+// returns a file of the recording, and starts a new one
+FMIDI_API fmidi_smf_t *fmidi_recorder_finish(fmidi_recorder_t *rec);
+
 //////////////
 // PRINTERS //
 //////////////
@@ -245,10 +555,22 @@ struct fmidi_seq_deleter {
     void operator()(fmidi_seq_t *x) const { fmidi_seq_free(x); } };
 struct fmidi_player_deleter {
     void operator()(fmidi_player_t *x) const { fmidi_player_free(x); } };
+struct fmidi_smf_builder_deleter {
+    void operator()(fmidi_smf_builder_t *x) const { fmidi_smf_builder_free(x); } };
+struct fmidi_recorder_deleter {
+    void operator()(fmidi_recorder_t *x) const { fmidi_recorder_free(x); } };
+struct fmidi_tempo_map_deleter {
+    void operator()(fmidi_tempo_map_t *x) const { fmidi_tempo_map_free(x); } };
+struct fmidi_timeline_deleter {
+    void operator()(fmidi_timeline_t *x) const { fmidi_timeline_free(x); } };
 
 typedef std::unique_ptr<fmidi_smf_t, fmidi_smf_deleter> fmidi_smf_u;
 typedef std::unique_ptr<fmidi_seq_t, fmidi_seq_deleter> fmidi_seq_u;
 typedef std::unique_ptr<fmidi_player_t, fmidi_player_deleter> fmidi_player_u;
+typedef std::unique_ptr<fmidi_smf_builder_t, fmidi_smf_builder_deleter> fmidi_smf_builder_u;
+typedef std::unique_ptr<fmidi_recorder_t, fmidi_recorder_deleter> fmidi_recorder_u;
+typedef std::unique_ptr<fmidi_tempo_map_t, fmidi_tempo_map_deleter> fmidi_tempo_map_u;
+typedef std::unique_ptr<fmidi_timeline_t, fmidi_timeline_deleter> fmidi_timeline_u;
 #endif
 
 ////////////////
@@ -0,0 +1,271 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include <vector>
+#include <memory>
+#include <string.h>
+
+// the largest delta which is representable as SMF variable length
+static constexpr uint32_t fmidi_builder_delta_max = (1u << 28) - 1;
+
+struct fmidi_builder_track {
+    fmidi_event_arena events;
+    uint64_t end_tick = 0;
+    bool ended = false;
+};
+
+struct fmidi_smf_builder {
+    fmidi_smf_info_t info;
+    std::vector<fmidi_builder_track> track;
+};
+
+fmidi_smf_builder_t *fmidi_smf_builder_new(uint16_t format, uint16_t delta_unit)
+{
+    if (format > 2)
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    fmidi_smf_builder_t *bld = new fmidi_smf_builder;
+    bld->info.format = format;
+    bld->info.track_count = 0;
+    bld->info.delta_unit = delta_unit;
+    return bld;
+}
+
+void fmidi_smf_builder_free(fmidi_smf_builder_t *bld)
+{
+    delete bld;
+}
+
+int fmidi_smf_builder_add_track(fmidi_smf_builder_t *bld)
+{
+    size_t ntracks = bld->track.size();
+    if (ntracks == UINT16_MAX || (bld->info.format == 0 && ntracks == 1))
+        RET_FAIL(-1, fmidi_err_input);
+
+    bld->track.emplace_back();
+    bld->info.track_count = ntracks + 1;
+    return (int)ntracks;
+}
+
+// Whether the message has an encoding in a file, which is what the readers
+// produce: a complete system exclusive, or a message of the size which its
+// status implies, with data bytes in either case.
+static bool fmidi_builder_check_message(const uint8_t *data, uint32_t datalen)
+{
+    if (datalen == 0 || !data)
+        return false;
+
+    uint8_t status = data[0];
+    uint32_t end = datalen;
+    if (status == 0xf0) {
+        if (datalen < 2 || data[datalen - 1] != 0xf7)
+            return false;
+        --end;
+    }
+    else if (status < 0x80 || status == 0xff || datalen != fmidi_message_sizeof(status))
+        return false;
+
+    for (uint32_t i = 1; i < end; ++i) {
+        if (data[i] & 0x80)
+            return false;
+    }
+    return true;
+}
+
+static bool fmidi_builder_check_event(
+    fmidi_event_type_t type, const uint8_t *data, uint32_t datalen)
+{
+    switch (type) {
+    case fmidi_event_meta:
+        return datalen > 0 && data;
+    case fmidi_event_message:
+        return fmidi_builder_check_message(data, datalen);
+    case fmidi_event_escape:
+        return datalen == 0 || data;
+    case fmidi_event_xmi_timbre:
+        return datalen == 2 && data;
+    case fmidi_event_xmi_branch_point:
+        return datalen == 1 && data;
+    }
+    return false;
+}
+
+static bool fmidi_builder_is_end_of_track(
+    fmidi_event_type_t type, const uint8_t *data)
+{
+    return type == fmidi_event_meta && (data[0] == 0x2f || data[0] == 0x3f);
+}
+
+static bool fmidi_builder_put(
+    fmidi_event_arena &arena, fmidi_event_type_t type, uint32_t delta,
+    const uint8_t *data, uint32_t datalen)
+{
+    fmidi_event_t *evt = fmidi_event_alloc(arena, datalen);
+    if (!evt)
+        RET_FAIL(false, fmidi_err_largefile);
+    evt->type = type;
+    evt->delta = delta;
+    evt->datalen = datalen;
+    if (datalen > 0)
+        memcpy(evt->data, data, datalen);
+    return true;
+}
+
+bool fmidi_smf_builder_append(
+    fmidi_smf_builder_t *bld, uint16_t track, fmidi_event_type_t type,
+    uint32_t delta, const uint8_t *data, uint32_t datalen)
+{
+    if (track >= bld->track.size())
+        RET_FAIL(false, fmidi_err_input);
+
+    fmidi_builder_track &trk = bld->track[track];
+    if (trk.ended || delta > fmidi_builder_delta_max ||
+        !fmidi_builder_check_event(type, data, datalen))
+        RET_FAIL(false, fmidi_err_input);
+
+    if (!fmidi_builder_put(trk.events, type, delta, data, datalen))
+        return false;
+
+    trk.end_tick += delta;
+    trk.ended = fmidi_builder_is_end_of_track(type, data);
+    return true;
+}
+
+bool fmidi_smf_builder_append_at(
+    fmidi_smf_builder_t *bld, uint16_t track, fmidi_event_type_t type,
+    uint64_t tick, const uint8_t *data, uint32_t datalen)
+{
+    if (track >= bld->track.size())
+        RET_FAIL(false, fmidi_err_input);
+
+    const fmidi_builder_track &trk = bld->track[track];
+    if (tick < trk.end_tick || tick - trk.end_tick > fmidi_builder_delta_max)
+        RET_FAIL(false, fmidi_err_input);
+
+    return fmidi_smf_builder_append(
+        bld, track, type, tick - trk.end_tick, data, datalen);
+}
+
+bool fmidi_smf_builder_insert(
+    fmidi_smf_builder_t *bld, uint16_t track,
+    const fmidi_builder_event_t *events, size_t count)
+{
+    if (track >= bld->track.size())
+        RET_FAIL(false, fmidi_err_input);
+
+    fmidi_builder_track &trk = bld->track[track];
+
+    for (size_t i = 0; i < count; ++i) {
+        const fmidi_builder_event_t &ev = events[i];
+        if ((i > 0 && ev.tick < events[i - 1].tick) ||
+            !fmidi_builder_check_event(ev.type, ev.data, ev.datalen) ||
+            fmidi_builder_is_end_of_track(ev.type, ev.data) ||
+            (trk.ended && ev.tick > trk.end_tick))
+            RET_FAIL(false, fmidi_err_input);
+    }
+
+    if (count == 0)
+        return true;
+
+    if (!trk.ended && events[0].tick >= trk.end_tick) {
+        // all past the end of track, append in place
+        uint64_t tick = trk.end_tick;
+        for (size_t i = 0; i < count; ++i) {
+            if (events[i].tick - tick > fmidi_builder_delta_max)
+                RET_FAIL(false, fmidi_err_input);
+            tick = events[i].tick;
+        }
+        uint32_t oldlength = trk.events.length;
+        tick = trk.end_tick;
+        for (size_t i = 0; i < count; ++i) {
+            const fmidi_builder_event_t &ev = events[i];
+            if (!fmidi_builder_put(
+                    trk.events, ev.type, ev.tick - tick, ev.data, ev.datalen)) {
+                trk.events.length = oldlength;
+                return false;
+            }
+            tick = ev.tick;
+        }
+        trk.end_tick = tick;
+        return true;
+    }
+
+    // merge into a new storage, the existing events first at equal ticks
+    fmidi_event_arena merged;
+    const uint8_t *evdata = trk.events.data.get();
+    const uint8_t *evend = evdata + trk.events.length;
+    uint64_t evtick = 0;
+    uint64_t lasttick = 0;
+    size_t index = 0;
+
+    while (evdata != evend || index < count) {
+        const fmidi_event_t *evt = nullptr;
+        if (evdata != evend) {
+            evt = (const fmidi_event_t *)evdata;
+            uint64_t tick = evtick + evt->delta;
+            bool eot = fmidi_builder_is_end_of_track(evt->type, evt->data);
+            if (index < count &&
+                (events[index].tick < tick || (eot && events[index].tick == tick)))
+                evt = nullptr;
+        }
+
+        uint64_t tick;
+        bool ok;
+        if (evt) {
+            tick = evtick += evt->delta;
+            evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+            ok = fmidi_builder_put(
+                merged, evt->type, tick - lasttick, evt->data, evt->datalen);
+        }
+        else {
+            const fmidi_builder_event_t &ev = events[index++];
+            tick = ev.tick;
+            if (tick - lasttick > fmidi_builder_delta_max)
+                RET_FAIL(false, fmidi_err_input);
+            ok = fmidi_builder_put(
+                merged, ev.type, tick - lasttick, ev.data, ev.datalen);
+        }
+        if (!ok)
+            return false;
+        lasttick = tick;
+    }
+
+    trk.events = std::move(merged);
+    trk.end_tick = lasttick;
+    return true;
+}
+
+fmidi_smf_t *fmidi_smf_builder_finish(fmidi_smf_builder_t *bld)
+{
+    static const uint8_t end_of_track[1] = {0x2f};
+
+    unsigned ntracks = bld->track.size();
+    for (unsigned i = 0; i < ntracks; ++i) {
+        fmidi_builder_track &trk = bld->track[i];
+        if (!trk.ended && !fmidi_builder_put(
+                trk.events, fmidi_event_meta, 0, end_of_track, 1))
+            return nullptr;
+        trk.ended = true;
+    }
+
+    fmidi_smf_u smf(new fmidi_smf);
+    smf->info = bld->info;
+    smf->track.reset(new fmidi_raw_track[ntracks]);
+
+    // the storage is handed over as it is, without copy
+    for (unsigned i = 0; i < ntracks; ++i) {
+        fmidi_event_arena &events = bld->track[i].events;
+        fmidi_raw_track &trk = smf->track[i];
+        fmidi_raw_track_assign(trk, events.data.release(), events.length);
+    }
+
+    bld->track.clear();
+    bld->info.track_count = 0;
+
+    return smf.release();
+}
@@ -0,0 +1,390 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include "fmidi/u_hash.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+
+static bool fmidi_canonical_is_end_of_track(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_meta &&
+        (evt->data[0] == 0x2f || evt->data[0] == 0x3f);
+}
+
+static bool fmidi_canonical_is_smpte_offset(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_meta && evt->data[0] == 0x54;
+}
+
+// the status byte in the file encoding
+static unsigned fmidi_canonical_status(const fmidi_event_t *evt)
+{
+    switch (evt->type) {
+    case fmidi_event_meta: return 0xff;
+    case fmidi_event_escape: return 0xf7;
+    default: return evt->data[0];
+    }
+}
+
+static int fmidi_canonical_compare(const fmidi_event_t *a, const fmidi_event_t *b)
+{
+    unsigned sa = fmidi_canonical_status(a);
+    unsigned sb = fmidi_canonical_status(b);
+    if (sa != sb)
+        return (sa < sb) ? -1 : +1;
+    int c = memcmp(a->data, b->data, std::min(a->datalen, b->datalen));
+    if (c != 0)
+        return c;
+    return (a->datalen > b->datalen) - (a->datalen < b->datalen);
+}
+
+// Whether the event is a channel message. Those of different channels can be
+// swapped, the other events are kept in place.
+static bool fmidi_canonical_is_channel(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_message && evt->data[0] < 0xf0;
+}
+
+namespace {
+
+struct Canonical_Cursor {
+    const uint8_t *evdata;
+    const uint8_t *evend;
+};
+
+struct Canonical_Key {
+    uint64_t tick;
+    unsigned track;
+};
+
+struct Canonical_Key_Greater {
+    bool operator()(const Canonical_Key &a, const Canonical_Key &b) const
+    {
+        return (a.tick != b.tick) ? (a.tick > b.tick) : (a.track > b.track);
+    }
+};
+
+// the events of a track at a tick, as indices of the tick events
+struct Canonical_Run {
+    size_t begin;
+    size_t end;
+};
+
+// Reads a group of tracks as a single time line, one tick at a time, with the
+// events in canonical order.
+class Canonical_Reader {
+public:
+    Canonical_Reader(const fmidi_smf_t *smf, unsigned first_track, unsigned track_count);
+    // gets the events of the next tick, or returns false at the end
+    bool next(uint64_t *tick, std::vector<const fmidi_event_t *> &events);
+    // the tick where the time line ends, valid at the end
+    uint64_t end_tick() const { return endtick; }
+private:
+    void append(const fmidi_event_t *evt);
+    const fmidi_event_t *event_at(size_t index) const
+        { return (const fmidi_event_t *)&buffer[offsets[index]]; }
+    int compare_runs(const Canonical_Run &a, const Canonical_Run &b) const;
+private:
+    std::vector<Canonical_Cursor> cursors;
+    std::vector<Canonical_Key> heap;
+    // the events of the current tick
+    std::vector<uint8_t> buffer;
+    std::vector<size_t> offsets;
+    std::vector<Canonical_Run> runs;
+    uint64_t endtick = 0;
+    bool have_smpte_offset = false;
+};
+
+Canonical_Reader::Canonical_Reader(
+    const fmidi_smf_t *smf, unsigned first_track, unsigned track_count)
+    : cursors(track_count)
+{
+    heap.reserve(track_count);
+    for (unsigned i = 0; i < track_count; ++i) {
+        const fmidi_raw_track &trk = smf->track[first_track + i];
+        Canonical_Cursor &cur = cursors[i];
+        cur.evdata = trk.data.get();
+        cur.evend = cur.evdata + trk.length;
+        if (cur.evdata != cur.evend)
+            heap.push_back(Canonical_Key{((const fmidi_event_t *)cur.evdata)->delta, i});
+    }
+    std::make_heap(heap.begin(), heap.end(), Canonical_Key_Greater());
+}
+
+bool Canonical_Reader::next(uint64_t *tick, std::vector<const fmidi_event_t *> &events)
+{
+    while (!heap.empty()) {
+        uint64_t now = heap.front().tick;
+        buffer.clear();
+        offsets.clear();
+        runs.clear();
+
+        while (!heap.empty() && heap.front().tick == now) {
+            std::pop_heap(heap.begin(), heap.end(), Canonical_Key_Greater());
+            Canonical_Key key = heap.back();
+            heap.pop_back();
+
+            Canonical_Cursor &cur = cursors[key.track];
+            Canonical_Run run{offsets.size(), 0};
+            bool ended = false;
+            do {
+                const fmidi_event_t *evt = (const fmidi_event_t *)cur.evdata;
+                cur.evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+                if (fmidi_canonical_is_end_of_track(evt)) {
+                    // the track ends here, the events past its end are dropped
+                    endtick = std::max(endtick, now);
+                    ended = true;
+                }
+                else
+                    append(evt);
+            } while (!ended && cur.evdata != cur.evend &&
+                     ((const fmidi_event_t *)cur.evdata)->delta == 0);
+            run.end = offsets.size();
+
+            if (run.end > run.begin)
+                runs.push_back(run);
+
+            if (!ended && cur.evdata != cur.evend) {
+                const fmidi_event_t *next = (const fmidi_event_t *)cur.evdata;
+                heap.push_back(Canonical_Key{now + next->delta, key.track});
+                std::push_heap(heap.begin(), heap.end(), Canonical_Key_Greater());
+            }
+        }
+
+        // the tracks in order of their contents, so their numbering is
+        // indifferent, and each keeps its own order of playback
+        if (runs.size() > 1) {
+            std::sort(
+                runs.begin(), runs.end(),
+                [this](const Canonical_Run &a, const Canonical_Run &b) -> bool
+                    { return compare_runs(a, b) < 0; });
+        }
+
+        events.clear();
+        for (const Canonical_Run &run : runs) {
+            for (size_t i = run.begin; i < run.end; ++i)
+                events.push_back(event_at(i));
+        }
+
+        // the channel messages between two other events, by channel, keeping
+        // the order within a channel, which is significant
+        auto channel_less = [](const fmidi_event_t *a, const fmidi_event_t *b) -> bool
+            { return (a->data[0] & 0x0f) < (b->data[0] & 0x0f); };
+        for (auto first = events.begin(); first != events.end();) {
+            if (!fmidi_canonical_is_channel(*first)) {
+                ++first;
+                continue;
+            }
+            auto last = std::find_if_not(first, events.end(), &fmidi_canonical_is_channel);
+            if (!std::is_sorted(first, last, channel_less))
+                std::stable_sort(first, last, channel_less);
+            first = last;
+        }
+
+        // a single offset is permitted, and it applies to the whole sequence
+        events.erase(
+            std::remove_if(
+                events.begin(), events.end(),
+                [this, now](const fmidi_event_t *evt) -> bool {
+                    if (!fmidi_canonical_is_smpte_offset(evt))
+                        return false;
+                    bool keep = !have_smpte_offset && now == 0;
+                    have_smpte_offset = true;
+                    return !keep;
+                }),
+            events.end());
+
+        if (!events.empty()) {
+            *tick = now;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Canonical_Reader::append(const fmidi_event_t *evt)
+{
+    // without an encoding in standard files
+    if (evt->type == fmidi_event_xmi_timbre ||
+        evt->type == fmidi_event_xmi_branch_point)
+        return;
+
+    uint32_t datalen = evt->datalen;
+    offsets.push_back(buffer.size());
+    fmidi_event_t *out = fmidi_event_alloc(buffer, datalen);
+    out->type = evt->type;
+    out->delta = 0;
+    out->datalen = datalen;
+    memcpy(out->data, evt->data, datalen);
+
+    // note-on of null velocity, as a note-off of default velocity
+    uint8_t *data = out->data;
+    if (out->type == fmidi_event_message && datalen == 3 &&
+        (data[0] & 0xf0) == 0x90 && data[2] == 0) {
+        data[0] = 0x80 | (data[0] & 0x0f);
+        data[2] = 64;
+    }
+}
+
+int Canonical_Reader::compare_runs(const Canonical_Run &a, const Canonical_Run &b) const
+{
+    size_t na = a.end - a.begin;
+    size_t nb = b.end - b.begin;
+    for (size_t i = 0, n = std::min(na, nb); i < n; ++i) {
+        int c = fmidi_canonical_compare(event_at(a.begin + i), event_at(b.begin + i));
+        if (c != 0)
+            return c;
+    }
+    return (na > nb) - (na < nb);
+}
+
+}  // namespace
+
+// Walks the canonical form of a file, as the header fields, then the
+// time-ordered events of each track, ending with the end-of-track.
+template <class Fn_Header, class Fn_Event>
+static void fmidi_canonical_walk(
+    const fmidi_smf_t *smf, Fn_Header &&on_header, Fn_Event &&on_event)
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    unsigned ntracks = info->track_count;
+
+    // independent tracks each have their own time line
+    bool independent = info->format == 2;
+    uint16_t format = independent ? 2 : 0;
+    uint16_t track_count = independent ? ntracks : 1;
+    on_header(format, track_count, info->delta_unit);
+
+    std::vector<uint8_t> endbuf;
+    fmidi_event_t *endevt = fmidi_event_alloc(endbuf, 1);
+    endevt->type = fmidi_event_meta;
+    endevt->delta = 0;
+    endevt->datalen = 1;
+    endevt->data[0] = 0x2f;
+
+    std::vector<const fmidi_event_t *> events;
+    for (unsigned t = 0; t < track_count; ++t) {
+        Canonical_Reader reader(
+            smf, independent ? t : 0, independent ? 1 : ntracks);
+
+        uint64_t lasttick = 0;
+        uint64_t tick;
+        while (reader.next(&tick, events)) {
+            for (size_t i = 0, n = events.size(); i < n; ++i)
+                on_event(t, i ? 0 : (tick - lasttick), events[i]);
+            lasttick = tick;
+        }
+
+        uint64_t endtick = std::max(reader.end_tick(), lasttick);
+        on_event(t, endtick - lasttick, endevt);
+    }
+}
+
+fmidi_smf_t *fmidi_smf_canonicalize(const fmidi_smf_t *smf)
+{
+    fmidi_smf_u out(new fmidi_smf);
+    std::unique_ptr<fmidi_event_arena[]> arenas;
+    bool overflow = false;
+
+    fmidi_canonical_walk(
+        smf,
+        [&](uint16_t format, uint16_t track_count, uint16_t delta_unit) {
+            out->info.format = format;
+            out->info.track_count = track_count;
+            out->info.delta_unit = delta_unit;
+            out->track.reset(new fmidi_raw_track[track_count]);
+            arenas.reset(new fmidi_event_arena[track_count]);
+        },
+        [&](unsigned track, uint64_t delta, const fmidi_event_t *evt) {
+            uint32_t datalen = evt->datalen;
+            fmidi_event_t *outevt = fmidi_event_alloc(arenas[track], datalen);
+            if (!outevt || delta > UINT32_MAX) {
+                overflow = true;
+                return;
+            }
+            outevt->type = evt->type;
+            outevt->delta = delta;
+            outevt->datalen = datalen;
+            memcpy(outevt->data, evt->data, datalen);
+        });
+
+    if (overflow)
+        RET_FAIL(nullptr, fmidi_err_largefile);
+
+    for (unsigned i = 0, n = out->info.track_count; i < n; ++i) {
+        fmidi_event_arena &arena = arenas[i];
+        fmidi_raw_track_assign(out->track[i], arena.data.release(), arena.length);
+    }
+
+    return out.release();
+}
+
+static void fmidi_hash_vlq(murmur3_128 &hash, uint64_t value)
+{
+    uint8_t bytes[10];
+    unsigned count = 0;
+    do {
+        bytes[count++] = value & 0x7f;
+        value >>= 7;
+    } while (value > 0);
+    while (count > 1)
+        hash.update_byte(bytes[--count] | 0x80);
+    hash.update_byte(bytes[0]);
+}
+
+static void fmidi_hash_be16(murmur3_128 &hash, uint16_t value)
+{
+    hash.update_byte(value >> 8);
+    hash.update_byte(value & 0xff);
+}
+
+void fmidi_smf_hash(const fmidi_smf_t *smf, uint8_t digest[16])
+{
+    murmur3_128 hash;
+
+    fmidi_canonical_walk(
+        smf,
+        [&](uint16_t format, uint16_t track_count, uint16_t delta_unit) {
+            fmidi_hash_be16(hash, format);
+            fmidi_hash_be16(hash, track_count);
+            fmidi_hash_be16(hash, delta_unit);
+        },
+        [&](unsigned, uint64_t delta, const fmidi_event_t *evt) {
+            // the file encoding, without running status
+            const uint8_t *data = evt->data;
+            uint32_t datalen = evt->datalen;
+            fmidi_hash_vlq(hash, delta);
+            switch (evt->type) {
+            case fmidi_event_meta:
+                hash.update_byte(0xff);
+                hash.update_byte(data[0]);
+                fmidi_hash_vlq(hash, datalen - 1);
+                hash.update(data + 1, datalen - 1);
+                break;
+            case fmidi_event_escape:
+                hash.update_byte(0xf7);
+                fmidi_hash_vlq(hash, datalen);
+                hash.update(data, datalen);
+                break;
+            default:
+                if (data[0] == 0xf0) {
+                    hash.update_byte(0xf0);
+                    fmidi_hash_vlq(hash, datalen - 1);
+                    hash.update(data + 1, datalen - 1);
+                }
+                else
+                    hash.update(data, datalen);
+                break;
+            }
+        });
+
+    hash.finish(digest);
+}
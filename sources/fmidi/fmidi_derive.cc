@@ -0,0 +1,65 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include <memory>
+#include <string.h>
+
+fmidi_smf_t *fmidi_smf_derive(const fmidi_smf_t *smf)
+{
+    unsigned ntracks = smf->info.track_count;
+
+    fmidi_smf_u out(new fmidi_smf);
+    out->info = smf->info;
+    out->track.reset(new fmidi_raw_track[ntracks]);
+
+    for (unsigned i = 0; i < ntracks; ++i)
+        out->track[i] = smf->track[i];
+
+    return out.release();
+}
+
+bool fmidi_smf_share_track(
+    fmidi_smf_t *dst, uint16_t dsttrack, const fmidi_smf_t *src, uint16_t srctrack)
+{
+    if (dsttrack >= dst->info.track_count || srctrack >= src->info.track_count)
+        RET_FAIL(false, fmidi_err_input);
+
+    dst->track[dsttrack] = src->track[srctrack];
+    fmidi_smf_modified(dst);
+    return true;
+}
+
+static void fmidi_raw_track_unshare(fmidi_raw_track &trk)
+{
+    if (trk.data.use_count() <= 1)
+        return;
+
+    uint32_t evdatalen = trk.length;
+    uint8_t *evdata = new uint8_t[evdatalen];
+    memcpy(evdata, trk.data.get(), evdatalen);
+    fmidi_raw_track_assign(trk, evdata, evdatalen);
+}
+
+fmidi_event_t *fmidi_smf_track_next_mutable(
+    fmidi_smf_t *smf, fmidi_track_iter_t *it)
+{
+    if (it->track >= smf->info.track_count)
+        return nullptr;
+
+    fmidi_raw_track &trk = smf->track[it->track];
+    if (it->index == trk.length)
+        return nullptr;
+
+    // copy on write, when the storage is shared with another file
+    fmidi_raw_track_unshare(trk);
+    fmidi_smf_modified(smf);
+
+    fmidi_event_t *evt = (fmidi_event_t *)&trk.data.get()[it->index];
+    it->index += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+    return evt;
+}
@@ -63,56 +63,84 @@ extern thread_local fmidi_error_info_t fmidi_last_error;
 
 //------------------------------------------------------------------------------
 #include <vector>
+#include <memory>
+#include <new>
 #include <algorithm>
-#include <type_traits>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
-class Writer {
+// The writers are not polymorphic. The encoder is instantiated for each
+// concrete writer, to let the compiler inline the byte-level operations.
+template <class T> class WriterT {
 public:
-    virtual ~Writer() {}
-    virtual void put(uint8_t byte) = 0;
-    virtual void write(const void *data, size_t size) = 0;
-    virtual void rwrite(const void *data, size_t size) = 0;
-    virtual void writeLE(const void *data, size_t size) = 0;
-    virtual void writeBE(const void *data, size_t size) = 0;
-    virtual off_t tell() const = 0;
-    virtual bool seek(off_t offset, int whence) = 0;
+    void rwrite(const void *data, size_t size);
+    void writeLE(const void *data, size_t size);
+    void writeBE(const void *data, size_t size);
 };
 
-template <class T> class WriterT : public Writer {
+// The writers only append, so the output can go to any sequential sink.
+
+class Counting_Writer : public WriterT<Counting_Writer> {
 public:
-    virtual ~WriterT() {}
-    void rwrite(const void *data, size_t size) override;
-    void writeLE(const void *data, size_t size) override;
-    void writeBE(const void *data, size_t size) override;
+    void put(uint8_t) { ++size; }
+    void write(const void *, size_t size) { this->size += size; }
+    size_t count() const { return size; }
+private:
+    size_t size = 0;
 };
 
+// writes into memory of a size known in advance, usually a Counting_Writer result
 class Memory_Writer : public WriterT<Memory_Writer> {
 public:
-    explicit Memory_Writer(std::vector<uint8_t> &mem)
-        : mem(mem), index(mem.size()) {}
-    void put(uint8_t byte) override;
-    void write(const void *data, size_t size) override;
-    off_t tell() const override;
-    bool seek(off_t offset, int whence) override;
+    explicit Memory_Writer(uint8_t *mem)
+        : mem(mem) {}
+    void put(uint8_t byte);
+    void write(const void *data, size_t size);
 private:
-    std::vector<uint8_t> &mem;
-    size_t index = 0;
+    uint8_t *mem = nullptr;
 };
 
-class Stream_Writer : public WriterT<Stream_Writer> {
+// collects the output into large chunks for a sequential sink
+template <class Sink>
+class Buffered_Writer : public WriterT<Buffered_Writer<Sink>> {
 public:
-    explicit Stream_Writer(FILE *stream)
-        : stream(stream) {}
-    void put(uint8_t byte) override;
-    void write(const void *data, size_t size) override;
-    off_t tell() const override;
-    bool seek(off_t offset, int whence) override;
+    // without memory for the buffer, the writer is in error
+    explicit Buffered_Writer(const Sink &sink)
+        : sink(sink), buffer(new (std::nothrow) uint8_t[buffer_size]),
+          capacity(buffer ? buffer_size : 0), error(!buffer) {}
+    ~Buffered_Writer() { flush(); }
+    void put(uint8_t byte);
+    void write(const void *data, size_t size);
+    bool flush();
 private:
+    enum { buffer_size = 64 * 1024 };
+    Sink sink;
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t capacity = 0;
+    size_t fill = 0;
+    bool error = false;
+};
+
+struct Stream_Sink {
+    Stream_Sink(FILE *stream) : stream(stream) {}
+    bool operator()(const uint8_t *data, size_t size)
+        { return fwrite(data, 1, size, stream) == size; }
     FILE *stream = nullptr;
 };
 
+struct Callback_Sink {
+    Callback_Sink(bool (*fn)(const uint8_t *, size_t, void *), void *cookie)
+        : fn(fn), cookie(cookie) {}
+    bool operator()(const uint8_t *data, size_t size)
+        { return fn(data, size, cookie); }
+    bool (*fn)(const uint8_t *, size_t, void *) = nullptr;
+    void *cookie = nullptr;
+};
+
+typedef Buffered_Writer<Stream_Sink> Stream_Writer;
+typedef Buffered_Writer<Callback_Sink> Callback_Writer;
+
 //------------------------------------------------------------------------------
 union Endian_check {
     uint32_t value;
@@ -148,27 +176,46 @@ void WriterT<T>::writeBE(const void *data, size_t size)
     }
 }
 
-inline off_t Memory_Writer::tell() const
+inline void Memory_Writer::put(uint8_t byte)
 {
-    return index;
+    *mem++ = byte;
 }
 
-inline void Stream_Writer::put(uint8_t byte)
+inline void Memory_Writer::write(const void *data, size_t size)
 {
-    fputc(byte, stream);
+    memcpy(mem, data, size);
+    mem += size;
 }
 
-inline void Stream_Writer::write(const void *data, size_t size)
+template <class Sink>
+inline void Buffered_Writer<Sink>::put(uint8_t byte)
 {
-    fwrite(data, size, 1, stream);
+    if (fill == capacity && !flush())
+        return;
+    buffer[fill++] = byte;
 }
 
-inline bool Stream_Writer::seek(off_t offset, int whence)
+template <class Sink>
+inline void Buffered_Writer<Sink>::write(const void *data, size_t size)
 {
-    return fseek(stream, offset, whence) == 0;
+    if (size > capacity - fill) {
+        if (!flush())
+            return;
+        if (size >= capacity) {
+            error = error || !sink((const uint8_t *)data, size);
+            return;
+        }
+    }
+    memcpy(&buffer[fill], data, size);
+    fill += size;
 }
 
-inline off_t Stream_Writer::tell() const
+template <class Sink>
+inline bool Buffered_Writer<Sink>::flush()
 {
-    return ftell(stream);
+    if (fill > 0) {
+        error = error || !sink(buffer.get(), fill);
+        fill = 0;
+    }
+    return !error;
 }
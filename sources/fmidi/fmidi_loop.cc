@@ -0,0 +1,85 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include <algorithm>
+
+// whether the text of the meta event is the name, ignoring case
+static bool fmidi_loop_text_is(const fmidi_event_t *evt, const char *name)
+{
+    const uint8_t *text = evt->data + 1;
+    uint32_t length = evt->datalen - 1;
+    for (uint32_t i = 0; i < length; ++i) {
+        if (name[i] == '\0')
+            return false;
+        uint8_t c = text[i];
+        c = (c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c;
+        uint8_t n = name[i];
+        n = (n >= 'A' && n <= 'Z') ? (n - 'A' + 'a') : n;
+        if (c != n)
+            return false;
+    }
+    return name[length] == '\0';
+}
+
+bool fmidi_smf_find_loop(const fmidi_smf_t *smf, unsigned conventions, fmidi_loop_t *loop)
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    unsigned ntracks = info->track_count;
+    if (info->format == 2 && ntracks > 1)
+        return false;
+
+    const uint64_t none = ~(uint64_t)0;
+    uint64_t cc_start = none;
+    uint64_t marker_start = none;
+    uint64_t marker_end = none;
+    uint64_t last_tick = 0;
+
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_raw_track &trk = smf->track[i];
+        const uint8_t *evdata = trk.data.get();
+        const uint8_t *evend = evdata + trk.length;
+        uint64_t tick = 0;
+        while (evdata != evend) {
+            const fmidi_event_t *evt = (const fmidi_event_t *)evdata;
+            evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+            tick += evt->delta;
+            const uint8_t *d = evt->data;
+            if (evt->type == fmidi_event_meta) {
+                if (d[0] == 0x2f || d[0] == 0x3f)  // end of track
+                    break;
+                if (d[0] == 0x01 || d[0] == 0x06) {  // text, marker
+                    if (fmidi_loop_text_is(evt, "loopStart"))
+                        marker_start = std::min(marker_start, tick);
+                    else if (fmidi_loop_text_is(evt, "loopEnd"))
+                        marker_end = std::min(marker_end, tick);
+                }
+            }
+            else if (evt->type == fmidi_event_message) {
+                if ((d[0] >> 4) == 0b1011 && evt->datalen == 3 && d[1] == 111)
+                    cc_start = std::min(cc_start, tick);
+            }
+            last_tick = std::max(last_tick, tick);
+        }
+    }
+
+    uint64_t start = none;
+    uint64_t end = last_tick;
+    if ((conventions & fmidi_loop_markers) && marker_start != none) {
+        start = marker_start;
+        if (marker_end != none && marker_end > start)
+            end = marker_end;
+    }
+    else if ((conventions & fmidi_loop_cc111) && cc_start != none)
+        start = cc_start;
+
+    if (start == none || start >= end)
+        return false;
+
+    loop->start = start;
+    loop->end = end;
+    return true;
+}
@@ -0,0 +1,141 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+struct Merge_Cursor {
+    const uint8_t *evdata;
+    const uint8_t *evend;
+};
+
+struct Merge_Key {
+    uint64_t tick;
+    unsigned track;
+};
+
+// ordering of the min-heap: the earliest tick first, then the lowest track
+struct Merge_Key_Greater {
+    bool operator()(const Merge_Key &a, const Merge_Key &b) const
+    {
+        return (a.tick != b.tick) ? (a.tick > b.tick) : (a.track > b.track);
+    }
+};
+
+}  // namespace
+
+static bool fmidi_merge_is_end_of_track(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_meta &&
+        (evt->data[0] == 0x2f || evt->data[0] == 0x3f);
+}
+
+static bool fmidi_merge_is_smpte_offset(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_meta && evt->data[0] == 0x54;
+}
+
+fmidi_smf_t *fmidi_smf_merge(const fmidi_smf_t *smf)
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    unsigned ntracks = info->track_count;
+
+    // independent tracks have no common time line
+    if (info->format == 2 && ntracks > 1)
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    std::unique_ptr<Merge_Cursor[]> cursors(new Merge_Cursor[ntracks]);
+    std::vector<Merge_Key> heap;
+    heap.reserve(ntracks);
+
+    size_t evdatalen = 0;
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_raw_track &trk = smf->track[i];
+        Merge_Cursor &cur = cursors[i];
+        cur.evdata = trk.data.get();
+        cur.evend = cur.evdata + trk.length;
+        evdatalen += trk.length;
+        if (cur.evdata != cur.evend) {
+            const fmidi_event_t *evt = (const fmidi_event_t *)cur.evdata;
+            heap.push_back(Merge_Key{evt->delta, i});
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), Merge_Key_Greater());
+
+    std::vector<uint8_t> evbuf;
+    evbuf.reserve(evdatalen + fmidi_event_pad(fmidi_event_sizeof(1)));
+
+    uint64_t lasttick = 0;
+    uint64_t endtick = 0;
+    bool have_smpte_offset = false;
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), Merge_Key_Greater());
+        Merge_Key key = heap.back();
+        heap.pop_back();
+
+        Merge_Cursor &cur = cursors[key.track];
+        const fmidi_event_t *evt = (const fmidi_event_t *)cur.evdata;
+        cur.evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+
+        if (fmidi_merge_is_end_of_track(evt)) {
+            // the track ends here, the events past its end are dropped
+            endtick = std::max(endtick, key.tick);
+            continue;
+        }
+
+        // a single offset is permitted, and it applies to the whole sequence
+        bool keep = true;
+        if (fmidi_merge_is_smpte_offset(evt)) {
+            keep = !have_smpte_offset && key.tick == 0;
+            have_smpte_offset = true;
+        }
+
+        if (keep) {
+            uint32_t datalen = evt->datalen;
+            fmidi_event_t *outevt = fmidi_event_alloc(evbuf, datalen);
+            outevt->type = evt->type;
+            outevt->delta = key.tick - lasttick;
+            outevt->datalen = datalen;
+            memcpy(outevt->data, evt->data, datalen);
+            lasttick = key.tick;
+        }
+
+        if (cur.evdata != cur.evend) {
+            const fmidi_event_t *next = (const fmidi_event_t *)cur.evdata;
+            heap.push_back(Merge_Key{key.tick + next->delta, key.track});
+            std::push_heap(heap.begin(), heap.end(), Merge_Key_Greater());
+        }
+    }
+
+    // the merged track ends with the last one
+    endtick = std::max(endtick, lasttick);
+    fmidi_event_t *endevt = fmidi_event_alloc(evbuf, 1);
+    endevt->type = fmidi_event_meta;
+    endevt->delta = endtick - lasttick;
+    endevt->datalen = 1;
+    endevt->data[0] = 0x2f;
+
+    fmidi_smf_u out(new fmidi_smf);
+    out->info.format = 0;
+    out->info.track_count = 1;
+    out->info.delta_unit = info->delta_unit;
+    out->track.reset(new fmidi_raw_track[1]);
+
+    fmidi_raw_track &trk = out->track[0];
+    uint32_t outlen = evbuf.size();
+    uint8_t *outdata = new uint8_t[outlen];
+    memcpy(outdata, evbuf.data(), outlen);
+    fmidi_raw_track_assign(trk, outdata, outlen);
+
+    return out.release();
+}
@@ -0,0 +1,380 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+enum Key_State : uint8_t { key_unknown, key_off, key_on };
+
+struct Key_Info {
+    Key_State state = key_unknown;
+    // the state before the note-on which started the key
+    Key_State before_on = key_unknown;
+    // the note-on which started the key
+    unsigned on_track = 0;
+    size_t on_index = 0;
+    uint64_t on_tick = 0;
+};
+
+// the state of a channel, where -1 is an unknown value
+struct Channel_State {
+    int16_t controller[128];
+    int16_t program;
+    int32_t bend;
+    int16_t pressure;
+    bool bank_changed;
+    Key_Info key[128];
+    Channel_State() { reset(); }
+    void reset();
+    void forget_keys();
+};
+
+void Channel_State::reset()
+{
+    std::fill(controller, controller + 128, -1);
+    program = -1;
+    bend = -1;
+    pressure = -1;
+    bank_changed = false;
+}
+
+void Channel_State::forget_keys()
+{
+    for (Key_Info &key : this->key)
+        key.state = key_unknown;
+}
+
+struct Port_State {
+    Channel_State channel[16];
+    // the last system exclusive, if nothing else came after it
+    const fmidi_event_t *last_sysex = nullptr;
+    uint64_t last_sysex_tick = 0;
+};
+
+struct Track_Cursor {
+    const uint8_t *evdata;
+    const uint8_t *evend;
+    size_t index;
+    uint8_t port;
+};
+
+struct Cursor_Key {
+    uint64_t tick;
+    unsigned track;
+};
+
+struct Cursor_Key_Greater {
+    bool operator()(const Cursor_Key &a, const Cursor_Key &b) const
+    {
+        return (a.tick != b.tick) ? (a.tick > b.tick) : (a.track > b.track);
+    }
+};
+
+class Optimizer {
+public:
+    Optimizer(const fmidi_smf_t *smf, unsigned flags, fmidi_optimize_report_t *report)
+        : smf(smf), flags(flags), report(report) {}
+    void run(unsigned first_track, unsigned track_count);
+    void reset() { for (std::unique_ptr<Port_State> &ps : ports) ps.reset(); }
+    std::vector<std::vector<bool>> removed;
+private:
+    void process(const fmidi_event_t *evt, unsigned track, size_t index,
+                 uint64_t tick, uint8_t port);
+    void process_channel(const fmidi_event_t *evt, unsigned track, size_t index,
+                         uint64_t tick, Port_State &ps);
+    void remove(unsigned track, size_t index, size_t *counter);
+    Port_State &port_state(uint8_t port);
+private:
+    const fmidi_smf_t *smf;
+    unsigned flags;
+    fmidi_optimize_report_t *report;
+    std::unique_ptr<Port_State> ports[128];
+};
+
+Port_State &Optimizer::port_state(uint8_t port)
+{
+    std::unique_ptr<Port_State> &ps = ports[port & 127];
+    if (!ps)
+        ps.reset(new Port_State);
+    return *ps;
+}
+
+void Optimizer::remove(unsigned track, size_t index, size_t *counter)
+{
+    removed[track][index] = true;
+    ++*counter;
+    ++report->total;
+}
+
+void Optimizer::run(unsigned first_track, unsigned track_count)
+{
+    std::vector<Track_Cursor> cursors(track_count);
+    std::vector<Cursor_Key> heap;
+    heap.reserve(track_count);
+
+    for (unsigned i = 0; i < track_count; ++i) {
+        const fmidi_raw_track &trk = smf->track[first_track + i];
+        Track_Cursor &cur = cursors[i];
+        cur.evdata = trk.data.get();
+        cur.evend = cur.evdata + trk.length;
+        cur.index = 0;
+        cur.port = 0;
+        if (cur.evdata != cur.evend)
+            heap.push_back(Cursor_Key{((const fmidi_event_t *)cur.evdata)->delta, i});
+    }
+    std::make_heap(heap.begin(), heap.end(), Cursor_Key_Greater());
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), Cursor_Key_Greater());
+        Cursor_Key key = heap.back();
+        heap.pop_back();
+
+        Track_Cursor &cur = cursors[key.track];
+        const fmidi_event_t *evt = (const fmidi_event_t *)cur.evdata;
+        cur.evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+
+        if (evt->type == fmidi_event_meta && evt->data[0] == 0x21 && evt->datalen >= 2)
+            cur.port = evt->data[1];
+
+        process(evt, first_track + key.track, cur.index++, key.tick, cur.port);
+
+        if (cur.evdata != cur.evend) {
+            const fmidi_event_t *next = (const fmidi_event_t *)cur.evdata;
+            heap.push_back(Cursor_Key{key.tick + next->delta, key.track});
+            std::push_heap(heap.begin(), heap.end(), Cursor_Key_Greater());
+        }
+    }
+}
+
+void Optimizer::process(
+    const fmidi_event_t *evt, unsigned track, size_t index, uint64_t tick, uint8_t port)
+{
+    if (evt->type != fmidi_event_message && evt->type != fmidi_event_escape)
+        return;
+
+    Port_State &ps = port_state(port);
+    const fmidi_event_t *last_sysex = ps.last_sysex;
+    ps.last_sysex = nullptr;
+
+    const uint8_t *data = evt->data;
+    uint32_t datalen = evt->datalen;
+
+    if (evt->type == fmidi_event_escape || data[0] >= 0xf0) {
+        bool sysex = evt->type == fmidi_event_message && data[0] == 0xf0;
+        if (sysex && (flags & fmidi_optimize_repeated_sysex) && last_sysex &&
+            ps.last_sysex_tick == tick && last_sysex->datalen == datalen &&
+            !memcmp(last_sysex->data, data, datalen)) {
+            // the repetition of a message just sent
+            remove(track, index, &report->sysex);
+            ps.last_sysex = last_sysex;
+            return;
+        }
+        if (sysex) {
+            ps.last_sysex = evt;
+            ps.last_sysex_tick = tick;
+        }
+        // it may reset or change anything
+        for (Channel_State &cs : ps.channel) {
+            cs.reset();
+            cs.forget_keys();
+        }
+        return;
+    }
+
+    if (datalen != fmidi_message_sizeof(data[0]))
+        return;
+
+    process_channel(evt, track, index, tick, ps);
+}
+
+void Optimizer::process_channel(
+    const fmidi_event_t *evt, unsigned track, size_t index, uint64_t tick, Port_State &ps)
+{
+    const uint8_t *data = evt->data;
+    unsigned status = data[0] & 0xf0;
+    unsigned channel = data[0] & 0x0f;
+    Channel_State &cs = ps.channel[channel];
+
+    switch (status) {
+    case 0x80:
+    case 0x90: {
+        Key_Info &key = cs.key[data[1] & 127];
+        bool on = status == 0x90 && data[2] != 0;
+        if (on) {
+            if (key.state == key_on && (flags & fmidi_optimize_redundant_notes)) {
+                remove(track, index, &report->notes);
+                break;
+            }
+            key.before_on = key.state;
+            key.state = key_on;
+            key.on_track = track;
+            key.on_index = index;
+            key.on_tick = tick;
+        }
+        else {
+            if (key.state == key_off && (flags & fmidi_optimize_redundant_notes)) {
+                remove(track, index, &report->notes);
+                break;
+            }
+            // a percussion note sounds even if empty, and a sustained one
+            int sustain = cs.controller[64];
+            if (key.state == key_on && key.on_tick == tick && channel != 9 &&
+                sustain >= 0 && sustain < 64 && (flags & fmidi_optimize_empty_notes)) {
+                // a note which retriggers a key maybe on only loses its note-on
+                remove(key.on_track, key.on_index, &report->empty_notes);
+                if (key.before_on == key_off)
+                    remove(track, index, &report->empty_notes);
+            }
+            key.state = key_off;
+        }
+        break;
+    }
+    case 0xb0: {
+        unsigned cc = data[1] & 127;
+        int value = data[2] & 127;
+        switch (cc) {
+        case 6: case 38:  // data entry
+        case 96: case 97:  // data increment, decrement
+        case 98: case 99: case 100: case 101:  // (N)RPN
+            // parameter changes depend on other state, keep
+            cs.controller[cc] = -1;
+            return;
+        case 120: case 123: case 124: case 125: case 126: case 127:
+            // the notes stop
+            for (Key_Info &key : cs.key)
+                key.state = key_off;
+            return;
+        case 121:
+            cs.reset();
+            return;
+        case 122:
+            return;
+        }
+        if (cs.controller[cc] == value && (flags & fmidi_optimize_redundant_controllers)) {
+            remove(track, index, &report->controllers);
+            break;
+        }
+        cs.controller[cc] = value;
+        if (cc == 0 || cc == 32)
+            cs.bank_changed = true;
+        break;
+    }
+    case 0xc0: {
+        int program = data[1] & 127;
+        if (cs.program == program && !cs.bank_changed &&
+            (flags & fmidi_optimize_redundant_programs)) {
+            remove(track, index, &report->programs);
+            break;
+        }
+        cs.program = program;
+        cs.bank_changed = false;
+        break;
+    }
+    case 0xd0: {
+        int pressure = data[1] & 127;
+        if (cs.pressure == pressure && (flags & fmidi_optimize_redundant_pressure)) {
+            remove(track, index, &report->pressure);
+            break;
+        }
+        cs.pressure = pressure;
+        break;
+    }
+    case 0xe0: {
+        int bend = (data[1] & 127) | ((data[2] & 127) << 7);
+        if (cs.bend == bend && (flags & fmidi_optimize_redundant_pitch_bend)) {
+            remove(track, index, &report->pitch_bends);
+            break;
+        }
+        cs.bend = bend;
+        break;
+    }
+    }
+}
+
+}  // namespace
+
+static void fmidi_optimize_rebuild(
+    const fmidi_raw_track &src, const std::vector<bool> &removed, fmidi_raw_track &dst)
+{
+    std::unique_ptr<uint8_t[]> evdata(new uint8_t[src.length]);
+    uint8_t *evout = evdata.get();
+
+    const uint8_t *evcur = src.data.get();
+    const uint8_t *evend = evcur + src.length;
+    uint32_t pending_delta = 0;
+    for (size_t index = 0; evcur != evend; ++index) {
+        const fmidi_event_t *evt = (const fmidi_event_t *)evcur;
+        size_t evsize = fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+        evcur += evsize;
+        if (removed[index]) {
+            pending_delta += evt->delta;
+            continue;
+        }
+        memcpy(evout, evt, evsize);
+        ((fmidi_event_t *)evout)->delta += pending_delta;
+        pending_delta = 0;
+        evout += evsize;
+    }
+
+    fmidi_raw_track_assign(dst, evdata.release(), evout - evdata.get());
+}
+
+fmidi_smf_t *fmidi_smf_optimize(
+    const fmidi_smf_t *smf, unsigned flags, fmidi_optimize_report_t *report)
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    unsigned ntracks = info->track_count;
+
+    fmidi_optimize_report_t local_report;
+    if (!report)
+        report = &local_report;
+    memset(report, 0, sizeof(*report));
+
+    Optimizer opt(smf, flags, report);
+    opt.removed.resize(ntracks);
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_raw_track &trk = smf->track[i];
+        const uint8_t *evcur = trk.data.get();
+        const uint8_t *evend = evcur + trk.length;
+        size_t count = 0;
+        for (; evcur != evend; ++count) {
+            const fmidi_event_t *evt = (const fmidi_event_t *)evcur;
+            evcur += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+        }
+        opt.removed[i].resize(count);
+        report->events += count;
+    }
+
+    // independent tracks each have their own state
+    if (info->format == 2) {
+        for (unsigned i = 0; i < ntracks; ++i) {
+            opt.reset();
+            opt.run(i, 1);
+        }
+    }
+    else
+        opt.run(0, ntracks);
+
+    fmidi_smf_u out(new fmidi_smf);
+    out->info = *info;
+    out->track.reset(new fmidi_raw_track[ntracks]);
+
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const std::vector<bool> &removed = opt.removed[i];
+        if (std::find(removed.begin(), removed.end(), true) == removed.end())
+            out->track[i] = smf->track[i];  // unchanged, shared
+        else
+            fmidi_optimize_rebuild(smf->track[i], removed, out->track[i]);
+    }
+
+    return out.release();
+}
@@ -13,12 +13,20 @@ struct fmidi_player_context {
     fmidi_seq_u seq;
     double timepos;
     double speed;
-    bool have_event;
-    fmidi_seq_event_t sqevt;
     void (*cbfn)(const fmidi_event_t *, void *);
     void *cbdata;
     void (*finifn)(void *);
     void *finidata;
+    // the blocks, counted in frames from an origin time so that rounding does
+    // not accumulate, and restarted when the time or the speed changes
+    bool block_sync;
+    bool block_open;
+    double block_rate;
+    double block_speed;
+    double block_origin;
+    uint64_t block_start;
+    uint64_t block_end;
+    double block_endtime;
 };
 
 struct fmidi_player {
@@ -36,11 +44,12 @@ fmidi_player_t *fmidi_player_new(fmidi_smf_t *smf)
     ctx.seq.reset(fmidi_seq_new(smf));
     ctx.timepos = 0;
     ctx.speed = 1;
-    ctx.have_event = false;
     ctx.cbfn = nullptr;
     ctx.cbdata = nullptr;
     ctx.finifn = nullptr;
     ctx.finidata = nullptr;
+    ctx.block_sync = false;
+    ctx.block_open = false;
 
     return plr.release();
 }
@@ -53,30 +62,86 @@ void fmidi_player_tick(fmidi_player_t *plr, double delta)
     void *cbdata = ctx.cbdata;
 
     double timepos = ctx.timepos;
-    bool have_event = ctx.have_event;
-    fmidi_seq_event_t &sqevt = ctx.sqevt;
-
     timepos += ctx.speed * delta;
 
-    bool more = have_event || fmidi_seq_next_event(&seq, &sqevt);
-    if (more) {
-        have_event = true;
-        while (more && timepos > sqevt.time) {
-            const fmidi_event_t &event = *sqevt.event;
-            if (cbfn)
-                cbfn(&event, cbdata);
-            have_event = more = fmidi_seq_next_event(&seq, &sqevt);
-        }
+    enum { batch_size = 64 };
+    fmidi_seq_event_t sqevts[batch_size];
+    for (size_t count;
+         (count = fmidi_seq_next_events(&seq, sqevts, batch_size, timepos)) > 0;) {
+        for (size_t i = 0; i < count && cbfn; ++i)
+            cbfn(sqevts[i].event, cbdata);
     }
 
-    ctx.have_event = have_event;
     ctx.timepos = timepos;
+    ctx.block_sync = false;
+    ctx.block_open = false;
+
+    if (!fmidi_seq_peek_event(&seq, nullptr)) {
+        plr->running = false;
+        if (ctx.finifn)
+            ctx.finifn(ctx.finidata);
+    }
+}
+
+size_t fmidi_player_render_block(
+    fmidi_player_t *plr, double sample_rate, uint32_t frames,
+    fmidi_player_block_event_t *events, size_t max)
+{
+    fmidi_player_context &ctx = plr->ctx;
+    fmidi_seq_t &seq = *ctx.seq;
+
+    if (!ctx.block_open) {
+        if (!ctx.block_sync || ctx.block_rate != sample_rate) {
+            ctx.block_sync = true;
+            ctx.block_rate = sample_rate;
+            ctx.block_speed = ctx.speed;
+            ctx.block_origin = ctx.timepos;
+            ctx.block_end = 0;
+        }
+        ctx.block_start = ctx.block_end;
+        ctx.block_end = ctx.block_start + frames;
+        ctx.block_endtime = ctx.block_origin +
+            ctx.block_speed * (double)ctx.block_end / sample_rate;
+    }
+
+    double origin = ctx.block_origin;
+    double rate = ctx.block_rate;
+    double speed = ctx.block_speed;
+    uint64_t start = ctx.block_start;
+    uint64_t end = ctx.block_end;
+    double endtime = ctx.block_endtime;
+
+    // the events belong to the block by their frame, which is computed once, so
+    // an event at the edge of blocks has a single place
+    size_t count = 0;
+    fmidi_seq_event_t sqevt;
+    bool more;
+    while ((more = fmidi_seq_peek_event(&seq, &sqevt))) {
+        if (speed <= 0)
+            break;
+        double position = (sqevt.time - origin) * rate / speed;
+        uint64_t frame = (position > 0) ? (uint64_t)position : 0;
+        if (frame >= end)
+            break;
+        if (count == max) {
+            ctx.block_open = true;
+            return count;
+        }
+        fmidi_seq_next_event(&seq, nullptr);
+        frame = (frame > start) ? (frame - start) : 0;
+        events[count++] = fmidi_player_block_event_t{(uint32_t)frame, sqevt.event};
+    }
+
+    ctx.block_open = false;
+    ctx.timepos = endtime;
 
     if (!more) {
         plr->running = false;
         if (ctx.finifn)
             ctx.finifn(ctx.finidata);
     }
+
+    return count;
 }
 
 void fmidi_player_free(fmidi_player_t *plr)
@@ -99,7 +164,8 @@ void fmidi_player_rewind(fmidi_player_t *plr)
     fmidi_player_context &ctx = plr->ctx;
     fmidi_seq_rewind(ctx.seq.get());
     ctx.timepos = 0;
-    ctx.have_event = false;
+    ctx.block_sync = false;
+    ctx.block_open = false;
 }
 
 bool fmidi_player_running(const fmidi_player_t *plr)
@@ -143,6 +209,7 @@ void fmidi_player_goto_time(fmidi_player_t *plr, double time)
     }
 
     ctx.timepos = time;
+    ctx.block_sync = false;
 
     if (ctx.cbfn) {
         uint8_t evtbuf[fmidi_event_sizeof(3)];
@@ -190,7 +257,9 @@ double fmidi_player_current_speed(const fmidi_player_t *plr)
 
 void fmidi_player_set_speed(fmidi_player_t *plr, double speed)
 {
-    plr->ctx.speed = speed;
+    fmidi_player_context &ctx = plr->ctx;
+    ctx.speed = speed;
+    ctx.block_sync = false;
 }
 
 void fmidi_player_event_callback(
@@ -0,0 +1,256 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+// A record of the ring buffer is a header followed by the message, padded to
+// the record alignment. A record never wraps around: when the space left at
+// the end is insufficient, the writer skips to the start, leaving a marker if
+// there is room for a header.
+struct fmidi_recorder_record {
+    double time;
+    uint32_t length;
+};
+
+static constexpr size_t fmidi_recorder_align = 8;
+static constexpr uint32_t fmidi_recorder_skip = UINT32_MAX;
+
+static size_t fmidi_recorder_pad(size_t size)
+{
+    size_t nb = size % fmidi_recorder_align;
+    return nb ? (size + fmidi_recorder_align - nb) : size;
+}
+
+struct fmidi_recorder {
+    uint16_t delta_unit;
+    uint32_t tempo;
+    // real-time side
+    std::unique_ptr<uint8_t[]> ring;
+    size_t capacity;
+    std::atomic<size_t> write_pos;
+    std::atomic<size_t> read_pos;
+    // non real-time side
+    fmidi_event_arena events;
+    uint64_t last_tick;
+};
+
+static void fmidi_recorder_restart(fmidi_recorder_t *rec)
+{
+    rec->events.length = 0;
+    rec->last_tick = 0;
+
+    // initial tempo, if time is metrical
+    if (!(rec->delta_unit & (1 << 15))) {
+        uint32_t tempo = rec->tempo;
+        fmidi_event_t *evt = fmidi_event_alloc(rec->events, 4);
+        evt->type = fmidi_event_meta;
+        evt->delta = 0;
+        evt->datalen = 4;
+        evt->data[0] = 0x51;
+        evt->data[1] = tempo >> 16;
+        evt->data[2] = tempo >> 8;
+        evt->data[3] = tempo;
+    }
+}
+
+fmidi_recorder_t *fmidi_recorder_new(uint16_t delta_unit, uint32_t tempo, size_t capacity)
+{
+    if (delta_unit == 0 || tempo == 0 || tempo > 0xffffff)
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    capacity = fmidi_recorder_pad(
+        std::max(capacity, 2 * sizeof(fmidi_recorder_record)));
+
+    std::unique_ptr<fmidi_recorder_t> rec(new fmidi_recorder);
+    rec->delta_unit = delta_unit;
+    rec->tempo = tempo;
+    rec->ring.reset(new uint8_t[capacity]);
+    rec->capacity = capacity;
+    rec->write_pos.store(0, std::memory_order_relaxed);
+    rec->read_pos.store(0, std::memory_order_relaxed);
+    fmidi_recorder_restart(rec.get());
+    return rec.release();
+}
+
+void fmidi_recorder_free(fmidi_recorder_t *rec)
+{
+    delete rec;
+}
+
+// Whether the message is one which a file stores: a channel message of the
+// length of its status, or a system exclusive which is complete.
+static bool fmidi_recorder_is_storable(const uint8_t *data, uint32_t datalen)
+{
+    if (datalen == 0)
+        return false;
+
+    uint8_t status = data[0];
+    uint32_t end = datalen;
+    if (status == 0xf0) {
+        if (datalen < 2 || data[datalen - 1] != 0xf7)
+            return false;
+        --end;
+    }
+    else if (status < 0x80 || status >= 0xf0 || datalen != fmidi_message_sizeof(status))
+        return false;
+
+    for (uint32_t i = 1; i < end; ++i) {
+        if (data[i] & 0x80)
+            return false;
+    }
+    return true;
+}
+
+bool fmidi_recorder_push(
+    fmidi_recorder_t *rec, double time, const uint8_t *data, uint32_t datalen)
+{
+    if (!fmidi_recorder_is_storable(data, datalen))
+        return false;
+
+    uint8_t *ring = rec->ring.get();
+    size_t capacity = rec->capacity;
+    size_t need = fmidi_recorder_pad(sizeof(fmidi_recorder_record) + datalen);
+    if (need > capacity)
+        return false;
+
+    size_t wp = rec->write_pos.load(std::memory_order_relaxed);
+    size_t rp = rec->read_pos.load(std::memory_order_acquire);
+
+    size_t offset = wp % capacity;
+    size_t contiguous = capacity - offset;
+    size_t total = (contiguous < need) ? (contiguous + need) : need;
+    if (capacity - (wp - rp) < total)
+        return false;
+
+    if (contiguous < need) {
+        if (contiguous >= sizeof(fmidi_recorder_record)) {
+            fmidi_recorder_record skip;
+            skip.time = 0;
+            skip.length = fmidi_recorder_skip;
+            memcpy(&ring[offset], &skip, sizeof(skip));
+        }
+        wp += contiguous;
+        offset = 0;
+    }
+
+    fmidi_recorder_record record;
+    record.time = time;
+    record.length = datalen;
+    memcpy(&ring[offset], &record, sizeof(record));
+    memcpy(&ring[offset + sizeof(record)], data, datalen);
+
+    rec->write_pos.store(wp + need, std::memory_order_release);
+    return true;
+}
+
+size_t fmidi_recorder_drain(fmidi_recorder_t *rec)
+{
+    const uint8_t *ring = rec->ring.get();
+    size_t capacity = rec->capacity;
+
+    size_t rp = rec->read_pos.load(std::memory_order_relaxed);
+    size_t wp = rec->write_pos.load(std::memory_order_acquire);
+
+    size_t count = 0;
+    while (rp != wp) {
+        size_t offset = rp % capacity;
+        size_t contiguous = capacity - offset;
+        if (contiguous < sizeof(fmidi_recorder_record)) {
+            rp += contiguous;
+            continue;
+        }
+
+        fmidi_recorder_record record;
+        memcpy(&record, &ring[offset], sizeof(record));
+        if (record.length == fmidi_recorder_skip) {
+            rp += contiguous;
+            continue;
+        }
+
+        // ticks since the start, in order of reception
+        double delta = fmidi_time_delta(
+            std::max(record.time, 0.0), rec->delta_unit, rec->tempo);
+        uint64_t tick = (uint64_t)std::llround(delta);
+        tick = std::max(tick, rec->last_tick);
+
+        fmidi_event_t *evt = fmidi_event_alloc(rec->events, record.length);
+        if (evt) {
+            evt->type = fmidi_event_message;
+            evt->delta = tick - rec->last_tick;
+            evt->datalen = record.length;
+            memcpy(evt->data, &ring[offset + sizeof(record)], record.length);
+            rec->last_tick = tick;
+            ++count;
+        }
+
+        rp += fmidi_recorder_pad(sizeof(record) + record.length);
+    }
+
+    rec->read_pos.store(rp, std::memory_order_release);
+    return count;
+}
+
+static fmidi_smf_t *fmidi_recorder_make_smf(
+    const fmidi_recorder_t *rec, uint8_t *evdata, uint32_t evdatalen)
+{
+    fmidi_smf_u smf(new fmidi_smf);
+    smf->info.format = 0;
+    smf->info.track_count = 1;
+    smf->info.delta_unit = rec->delta_unit;
+    smf->track.reset(new fmidi_raw_track[1]);
+    fmidi_raw_track_assign(smf->track[0], evdata, evdatalen);
+    return smf.release();
+}
+
+static bool fmidi_recorder_end_track(fmidi_event_arena &events)
+{
+    fmidi_event_t *evt = fmidi_event_alloc(events, 1);
+    if (!evt)
+        RET_FAIL(false, fmidi_err_largefile);
+    evt->type = fmidi_event_meta;
+    evt->delta = 0;
+    evt->datalen = 1;
+    evt->data[0] = 0x2f;
+    return true;
+}
+
+fmidi_smf_t *fmidi_recorder_snapshot(fmidi_recorder_t *rec)
+{
+    fmidi_recorder_drain(rec);
+
+    fmidi_event_arena events;
+    uint32_t length = rec->events.length;
+    events.data.reset(new uint8_t[length + fmidi_event_pad(fmidi_event_sizeof(1))]);
+    events.capacity = length + fmidi_event_pad(fmidi_event_sizeof(1));
+    events.length = length;
+    memcpy(events.data.get(), rec->events.data.get(), length);
+    if (!fmidi_recorder_end_track(events))
+        return nullptr;
+
+    return fmidi_recorder_make_smf(rec, events.data.release(), events.length);
+}
+
+fmidi_smf_t *fmidi_recorder_finish(fmidi_recorder_t *rec)
+{
+    fmidi_recorder_drain(rec);
+
+    fmidi_event_arena &events = rec->events;
+    if (!fmidi_recorder_end_track(events))
+        return nullptr;
+
+    uint32_t length = events.length;
+    events.capacity = 0;
+    fmidi_smf_t *smf = fmidi_recorder_make_smf(rec, events.data.release(), length);
+
+    fmidi_recorder_restart(rec);
+    return smf;
+}
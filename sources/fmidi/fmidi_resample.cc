@@ -0,0 +1,216 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include "fmidi/u_parallel.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string.h>
+
+// the largest delta which is representable as SMF variable length
+static constexpr uint64_t fmidi_resample_delta_max = (1u << 28) - 1;
+
+// the tempo of the files converted from SMPTE time
+static constexpr uint32_t fmidi_resample_tempo = 500000;
+
+static bool fmidi_unit_is_smpte(uint16_t unit)
+{
+    return unit & (1 << 15);
+}
+
+// delta units per second, for SMPTE time, as a ratio; 29 is 30 drop-frame,
+// which has 30000 frames in 1001 seconds
+struct fmidi_unit_rate {
+    uint64_t num;
+    uint64_t den;
+};
+
+static fmidi_unit_rate fmidi_unit_rate_of(uint16_t unit)
+{
+    unsigned tpf = unit & 0xff;  // delta units per frame
+    unsigned fps = -(int8_t)(unit >> 8);  // frames per second
+    if (fps == 29)
+        return fmidi_unit_rate{tpf * 30000, 1001};
+    return fmidi_unit_rate{tpf * fps, 1};
+}
+
+static uint64_t fmidi_gcd(uint64_t a, uint64_t b)
+{
+    while (b != 0) {
+        uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+static bool fmidi_unit_is_valid(uint16_t unit)
+{
+    if (!fmidi_unit_is_smpte(unit))
+        return unit != 0;
+    unsigned fps = -(int8_t)(unit >> 8);
+    return (unit & 0xff) != 0 &&
+        (fps == 24 || fps == 25 || fps == 29 || fps == 30);
+}
+
+static uint64_t fmidi_rescale(
+    uint64_t value, uint64_t num, uint64_t den, fmidi_rounding_t rounding)
+{
+    uint64_t product = value * num;
+    switch (rounding) {
+    default:
+    case fmidi_round_nearest: return (product + den / 2) / den;
+    case fmidi_round_down: return product / den;
+    case fmidi_round_up: return (product + den - 1) / den;
+    }
+}
+
+static uint64_t fmidi_round(double value, fmidi_rounding_t rounding)
+{
+    // tolerate the imprecision of computing in seconds
+    const double epsilon = 1e-6;
+    switch (rounding) {
+    default:
+    case fmidi_round_nearest: return (uint64_t)std::floor(value + 0.5);
+    case fmidi_round_down: return (uint64_t)std::floor(value + epsilon);
+    case fmidi_round_up: return (uint64_t)std::max(0.0, std::ceil(value - epsilon));
+    }
+}
+
+static bool fmidi_is_tempo(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_meta && evt->data[0] == 0x51 && evt->datalen == 4;
+}
+
+fmidi_smf_t *fmidi_smf_resample(
+    const fmidi_smf_t *smf, uint16_t delta_unit, fmidi_rounding_t rounding)
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    uint16_t old_unit = info->delta_unit;
+    unsigned ntracks = info->track_count;
+
+    if (!fmidi_unit_is_valid(delta_unit) || !fmidi_unit_is_valid(old_unit))
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    bool old_smpte = fmidi_unit_is_smpte(old_unit);
+    bool new_smpte = fmidi_unit_is_smpte(delta_unit);
+
+    // linear conversions are exact ratios, the other is through seconds
+    uint64_t num = 0, den = 0;
+    fmidi_unit_rate old_rate = fmidi_unit_rate_of(old_unit);
+    fmidi_unit_rate new_rate = fmidi_unit_rate_of(delta_unit);
+    if (!old_smpte && !new_smpte)
+        num = delta_unit, den = old_unit;
+    else if (old_smpte && new_smpte)
+        num = new_rate.num * old_rate.den, den = new_rate.den * old_rate.num;
+    else if (old_smpte && !new_smpte)
+        num = (uint64_t)delta_unit * (1000000 / fmidi_resample_tempo) * old_rate.den,
+            den = old_rate.num;
+    bool linear = num != 0;
+    if (linear) {
+        uint64_t gcd = fmidi_gcd(num, den);
+        num /= gcd;
+        den /= gcd;
+    }
+
+    // tempo maps, a common one, or one per track if they are independent
+    bool independent = info->format == 2;
+    std::vector<fmidi_tempo_map_u> tempo_maps;
+    if (!linear) {
+        tempo_maps.resize(independent ? ntracks : 1);
+        for (unsigned i = 0, n = tempo_maps.size(); i < n; ++i)
+            tempo_maps[i].reset(fmidi_tempo_map_new(smf, i));
+    }
+    double new_units_per_second = new_smpte ? ((double)new_rate.num / new_rate.den) : 0;
+
+    fmidi_smf_u out(new fmidi_smf);
+    out->info = *info;
+    out->info.delta_unit = delta_unit;
+    out->track.reset(new fmidi_raw_track[ntracks]);
+
+    // from SMPTE, the new tempo goes first in each time line
+    static const uint8_t tempo_event[4] = {
+        0x51, fmidi_resample_tempo >> 16,
+        (fmidi_resample_tempo >> 8) & 0xff, fmidi_resample_tempo & 0xff };
+    size_t tempo_size = fmidi_event_pad(fmidi_event_sizeof(4));
+    auto has_tempo_prefix = [&](unsigned track) -> bool
+        { return old_smpte && !new_smpte && (independent || track == 0); };
+
+    std::atomic<bool> overflow{false};
+
+    size_t events = 0;
+    for (unsigned i = 0; i < ntracks; ++i)
+        events += fmidi_raw_track_event_count(smf->track[i]);
+
+    fmidi_parallel_for(ntracks, events, [&](size_t track) {
+        const fmidi_raw_track &src = smf->track[track];
+        fmidi_raw_track &dst = out->track[track];
+
+        size_t prefix = has_tempo_prefix(track) ? tempo_size : 0;
+        std::unique_ptr<uint8_t[]> evdata(new uint8_t[prefix + src.length]);
+
+        if (prefix) {
+            fmidi_event_t *evt = (fmidi_event_t *)evdata.get();
+            evt->type = fmidi_event_meta;
+            evt->delta = 0;
+            evt->datalen = 4;
+            memcpy(evt->data, tempo_event, 4);
+        }
+
+        // times from the start of the time line, its SMPTE offset is kept as is
+        const fmidi_tempo_map_t *map = nullptr;
+        double start = 0;
+        if (!linear) {
+            map = tempo_maps[independent ? track : 0].get();
+            size_t count;
+            start = fmidi_tempo_map_segments(map, &count)[0].time;
+        }
+
+        // rounding is on absolute ticks, so the error does not accumulate
+        uint64_t old_tick = 0;
+        uint64_t new_tick = 0;
+        const uint8_t *evcur = src.data.get();
+        const uint8_t *evend = evcur + src.length;
+        uint8_t *evout = evdata.get() + prefix;
+        while (evcur != evend) {
+            const fmidi_event_t *evt = (const fmidi_event_t *)evcur;
+            size_t evsize = fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+            evcur += evsize;
+            old_tick += evt->delta;
+
+            // the tempo had no effect in SMPTE time, it would have now
+            if (old_smpte && !new_smpte && fmidi_is_tempo(evt))
+                continue;
+
+            uint64_t tick = linear ?
+                fmidi_rescale(old_tick, num, den, rounding) :
+                fmidi_round(
+                    (fmidi_tempo_map_tick_to_seconds(map, old_tick) - start) *
+                        new_units_per_second,
+                    rounding);
+            tick = std::max(tick, new_tick);
+            uint64_t delta = tick - new_tick;
+            if (delta > fmidi_resample_delta_max)
+                overflow = true;
+
+            memcpy(evout, evt, evsize);
+            ((fmidi_event_t *)evout)->delta = delta;
+            evout += evsize;
+            new_tick = tick;
+        }
+
+        fmidi_raw_track_assign(dst, evdata.release(), evout - evdata.get());
+    });
+
+    if (overflow)
+        RET_FAIL(nullptr, fmidi_err_input);
+
+    return out.release();
+}
@@ -4,37 +4,169 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "fmidi/fmidi.h"
+#include "fmidi/fmidi_internal.h"
+#include "fmidi/fmidi_util.h"
+#include <vector>
+#include <bitset>
 #include <memory>
+#include <algorithm>
 #include <string.h>
 
 struct fmidi_seq_timing {
     fmidi_smpte startoffset;
     uint32_t tempo;
+    // the start of the current tempo, from which times are computed
+    uint64_t segment_tick;
+    double segment_time;
 };
 
 struct fmidi_seq_pending_event {
     const fmidi_event_t *event;
-    double delta;
+    uint64_t tick;
 };
 
+// the notes which are on, by channel and key
+typedef std::bitset<16 * 128> fmidi_seq_notes;
+
 struct fmidi_seq_track_info {
-    double timepos;
+    uint64_t tickpos;
     fmidi_track_iter_t iter;
     fmidi_seq_pending_event next;
     std::shared_ptr<fmidi_seq_timing> timing;
+    // the notes which are on, unknown after a restored state, which has them
+    // implied by its position
+    fmidi_seq_notes notes;
+    bool notes_known;
+};
+
+// an entry of the queue of tracks, by position of their next event
+struct fmidi_seq_queue_entry {
+    double time;
+    uint64_t tick;
+    uint16_t track;
+};
+
+// Ordering of the min-heap: the earliest first, then the lowest track.
+// Tracks on a common timing are ordered by tick, which is exact and which
+// remains valid across tempo changes. Independent tracks are ordered by time,
+// which is definitive when they are queued, each having its own tempo; their
+// ticks are not comparable, so events at a same time go by track.
+struct fmidi_seq_queue_greater {
+    bool by_time;
+    bool operator()(const fmidi_seq_queue_entry &a, const fmidi_seq_queue_entry &b) const
+    {
+        if (by_time)
+            return (a.time != b.time) ? (a.time > b.time) : (a.track > b.track);
+        return (a.tick != b.tick) ? (a.tick > b.tick) : (a.track > b.track);
+    }
+};
+
+// The state of a track and of its timing, saved at a checkpoint. The notes
+// which are on are not saved, they are found again from the file if needed.
+struct fmidi_seq_track_state {
+    fmidi_track_iter_t iter;
+    uint64_t tickpos;
+    fmidi_seq_pending_event next;
+    uint32_t tempo;
+    uint64_t segment_tick;
+    double segment_time;
+};
+
+// A position which a seek can restore, recorded the first time that the
+// sequence reaches it, at a fixed interval of events. The track states are
+// stored apart, one per track.
+struct fmidi_seq_checkpoint {
+    uint64_t count;  // the number of events played before
+    double time;  // the time of the next event
+    uint64_t tick;  // the tick of the next event
+};
+
+// An XMI branch point, and the state of its track before it. The branch point
+// event has the delta of the event which follows it.
+struct fmidi_seq_branch_point {
+    uint16_t track;
+    uint8_t id;
+    fmidi_track_iter_t iter;
+    uint64_t tick;
+    uint32_t delta;
+    uint32_t tempo;
 };
 
 struct fmidi_seq {
     const fmidi_smf_t *smf;
     std::unique_ptr<fmidi_seq_track_info[]> track;
+    std::vector<fmidi_seq_queue_entry> queue;
+    fmidi_seq_queue_greater queue_order;
+    uint64_t count;
+    // the seek index, allocated in full by the first seek
+    bool indexing;
+    uint64_t checkpoint_interval;
+    std::vector<fmidi_seq_checkpoint> checkpoints;
+    std::vector<fmidi_seq_track_state> checkpoint_tracks;
+    // the loop, and the state of the tracks at its start
+    bool looping;
+    fmidi_loop_t loop;
+    uint64_t loop_count;
+    std::vector<fmidi_seq_track_state> loop_tracks;
+    fmidi_tempo_map_u loop_map;
+    // whether the sequence has returned to the loop start since the rewind
+    bool wrapped;
+    // the time of the last event played, or of the position which a seek
+    // restored
+    double time;
+    // the branch points of all tracks, indexed when first branching
+    bool branches_indexed;
+    std::vector<fmidi_seq_branch_point> branches;
+    // whether a branch has diverted the sequence from the file
+    bool branched;
+    // the note-offs of the notes which were on at a branch, played next, and
+    // the storage of a note-off for every channel and key
+    std::vector<fmidi_seq_event_t> releases;
+    size_t releases_played;
+    std::vector<uint8_t> note_offs;
 };
 
-static double fmidi_convert_delta(
-    const fmidi_seq_t *seq, uint16_t trkno, double delta)
+// The least distance between checkpoints, in events. The interval grows with
+// the track count, so saving states stays a small cost.
+static constexpr uint64_t fmidi_seq_checkpoint_events = 1024;
+
+static double fmidi_seq_time_at(
+    const fmidi_seq_t *seq, const fmidi_seq_timing &timing, uint64_t tick)
 {
     uint16_t unit = fmidi_smf_get_info(seq->smf)->delta_unit;
-    uint32_t tempo = seq->track[trkno].timing->tempo;
-    return fmidi_delta_time(delta, unit, tempo);
+    return timing.segment_time +
+        fmidi_delta_time(tick - timing.segment_tick, unit, timing.tempo);
+}
+
+// Reads the next event of the track, and puts the track in the queue.
+static bool fmidi_seq_track_fetch(fmidi_seq_t *seq, uint16_t trkno)
+{
+    const fmidi_smf_t *smf = seq->smf;
+    fmidi_seq_track_info &track = seq->track[trkno];
+
+    track.next.event = nullptr;
+
+    const fmidi_event_t *evt = fmidi_smf_track_next(smf, &track.iter);
+    if (!evt)
+        return false;
+
+    if (evt->type == fmidi_event_meta) {
+        uint8_t tag = evt->data[0];
+        if (tag == 0x2f || tag == 0x3f)  // end of track
+            return false;  // stop now even if the final event has delta
+    }
+
+    fmidi_seq_pending_event &pending = track.next;
+    pending.event = evt;
+    pending.tick = track.tickpos + evt->delta;
+
+    double time = 0;
+    if (seq->queue_order.by_time)
+        time = fmidi_seq_time_at(seq, *track.timing, pending.tick);
+
+    seq->queue.push_back(fmidi_seq_queue_entry{time, pending.tick, trkno});
+    std::push_heap(seq->queue.begin(), seq->queue.end(), seq->queue_order);
+    return true;
 }
 
 fmidi_seq_t *fmidi_seq_new(const fmidi_smf_t *smf)
@@ -47,6 +179,10 @@ fmidi_seq_t *fmidi_seq_new(const fmidi_smf_t *smf)
     uint16_t ntracks = info->track_count;
 
     seq->track.reset(new fmidi_seq_track_info[ntracks]);
+    seq->queue_order.by_time = format == 2 && ntracks > 1;
+    seq->indexing = false;
+    seq->looping = false;
+    seq->branches_indexed = false;
 
     for (unsigned i = 0; i < ntracks; ++i) {
         fmidi_seq_track_info &track = seq->track[i];
@@ -82,9 +218,13 @@ void fmidi_seq_rewind(fmidi_seq_t *seq)
         fmidi_smpte &startoffset = timing->startoffset;
         fmidi_smf_track_begin(&track.iter, i);
         track.next.event = nullptr;
+        track.tickpos = 0;
+        track.notes.reset();
+        track.notes_known = true;
         memset(startoffset.code, 0, 5);
         timing->tempo = 500000;
-        track.timepos = fmidi_smpte_time(&startoffset);
+        timing->segment_tick = 0;
+        timing->segment_time = 0;
     }
 
     for (unsigned i = 0; i < ntracks; ++i) {
@@ -108,102 +248,296 @@ void fmidi_seq_rewind(fmidi_seq_t *seq)
                 timing->tempo = (d24[0] << 16) | (d24[1] << 8) | d24[2];
             }
         }
-        track.timepos = fmidi_smpte_time(&startoffset);
+        timing->segment_time = fmidi_smpte_time(&startoffset);
     }
+
+    seq->queue.clear();
+    seq->queue.reserve(ntracks);
+    for (unsigned i = 0; i < ntracks; ++i)
+        fmidi_seq_track_fetch(seq, i);
+
+    seq->count = 0;
+    seq->time = 0;
+    seq->branched = false;
+    seq->wrapped = false;
+    seq->releases.clear();
+    seq->releases_played = 0;
 }
 
-static fmidi_seq_pending_event *fmidi_seq_track_current_event(
-    fmidi_seq_t *seq, uint16_t trkno)
+bool fmidi_seq_peek_event(fmidi_seq_t *seq, fmidi_seq_event_t *sqevt)
 {
-    const fmidi_smf_t *smf = seq->smf;
-    fmidi_seq_track_info &track = seq->track[trkno];
+    if (seq->releases_played < seq->releases.size()) {
+        if (sqevt)
+            *sqevt = seq->releases[seq->releases_played];
+        return true;
+    }
 
-    fmidi_seq_pending_event *pending;
-    if (track.next.event)
-        return &track.next;
+    if (seq->queue.empty())
+        return false;
 
-    const fmidi_event_t *evt = fmidi_smf_track_next(smf, &track.iter);
-    if (!evt)
-        return nullptr;
+    unsigned trkno = seq->queue.front().track;
+    const fmidi_seq_track_info &trk = seq->track[trkno];
+    const fmidi_seq_pending_event &pevt = trk.next;
 
-    if (evt->type == fmidi_event_meta) {
-        uint8_t tag = evt->data[0];
-        if (tag == 0x2f || tag == 0x3f)  // end of track
-            return nullptr;  // stop now even if the final event has delta
+    if (sqevt) {
+        sqevt->time = fmidi_seq_time_at(seq, *trk.timing, pevt.tick);
+        sqevt->track = trkno;
+        sqevt->event = pevt.event;
+        sqevt->tick = pevt.tick;
     }
 
-    pending = &track.next;
-    pending->event = evt;
-    pending->delta = evt->delta;
-    return pending;
+    return true;
 }
 
-static int fmidi_seq_next_track(fmidi_seq_t *seq)
+// Appends the states of all tracks.
+static void fmidi_seq_save_tracks(
+    const fmidi_seq_t *seq, std::vector<fmidi_seq_track_state> &states)
 {
-    const fmidi_smf_info_t *info = fmidi_smf_get_info(seq->smf);
-    unsigned ntracks = info->track_count;
-
-    unsigned trkno = 0;
-    fmidi_seq_pending_event *pevt;
-
-    pevt = fmidi_seq_track_current_event(seq, 0);
-    while (!pevt && ++trkno < ntracks)
-        pevt = fmidi_seq_track_current_event(seq, trkno);
-
-    if (!pevt)
-        return -1;
-
-    double nearest = fmidi_convert_delta(seq, trkno, pevt->delta) +
-        seq->track[trkno].timepos;
-    for (unsigned i = trkno + 1; i < ntracks; ++i) {
-        if ((pevt = fmidi_seq_track_current_event(seq, i))) {
-            double time = fmidi_convert_delta(seq, i, pevt->delta) +
-                seq->track[i].timepos;
-            if (time < nearest) {
-                trkno = i;
-                nearest = time;
-            }
-        }
+    unsigned ntracks = fmidi_smf_get_info(seq->smf)->track_count;
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_seq_track_info &track = seq->track[i];
+        const fmidi_seq_timing &timing = *track.timing;
+        states.push_back(fmidi_seq_track_state{
+            track.iter, track.tickpos, track.next,
+            timing.tempo, timing.segment_tick, timing.segment_time});
+    }
+}
+
+// Allocates the seek index, for all the events which the file has, so that
+// recording the checkpoints does not allocate during playback.
+static void fmidi_seq_start_index(fmidi_seq_t *seq)
+{
+    const fmidi_smf_t *smf = seq->smf;
+    unsigned ntracks = fmidi_smf_get_info(smf)->track_count;
+
+    uint64_t total = 0;
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_event_t *evt;
+        fmidi_track_iter_t it;
+        fmidi_smf_track_begin(&it, i);
+        while ((evt = fmidi_smf_track_next(smf, &it)) &&
+               !(evt->type == fmidi_event_meta &&
+                 (evt->data[0] == 0x2f || evt->data[0] == 0x3f)))  // end of track
+            ++total;
     }
 
-    return trkno;
+    uint64_t interval = std::max<uint64_t>(fmidi_seq_checkpoint_events, 4 * ntracks);
+    size_t capacity = total / interval + 1;
+    seq->checkpoint_interval = interval;
+    seq->checkpoints.reserve(capacity);
+    seq->checkpoint_tracks.reserve(capacity * ntracks);
+    seq->indexing = true;
 }
 
-bool fmidi_seq_peek_event(fmidi_seq_t *seq, fmidi_seq_event_t *sqevt)
+// Records the current position, if it is the next one which the index lacks.
+static void fmidi_seq_save_checkpoint(fmidi_seq_t *seq, double time, uint64_t tick)
 {
-    unsigned trkno = fmidi_seq_next_track(seq);
-    if ((int)trkno == -1)
-        return false;
+    std::vector<fmidi_seq_checkpoint> &checkpoints = seq->checkpoints;
+    uint64_t count = seq->count;
 
-    fmidi_seq_track_info &nexttrk = seq->track[trkno];
+    if (!seq->indexing)
+        return;
 
-    const fmidi_seq_pending_event *pevt =
-        fmidi_seq_track_current_event(seq, trkno);
-    if (!pevt)
-        return false;
+    // the index is of the sequence of the file, which branches and the
+    // repetitions of the loop do not follow
+    if (seq->branched || seq->wrapped)
+        return;
 
-    if (sqevt) {
-        sqevt->time = fmidi_convert_delta(seq, trkno, pevt->delta) + nexttrk.timepos;
-        sqevt->track = trkno;
-        sqevt->event = pevt->event;
+    size_t index = checkpoints.size();
+    if (count != index * seq->checkpoint_interval || index == checkpoints.capacity())
+        return;
+
+    checkpoints.push_back(fmidi_seq_checkpoint{count, time, tick});
+    fmidi_seq_save_tracks(seq, seq->checkpoint_tracks);
+}
+
+// Restores the states of all tracks, with times later by the shift.
+static void fmidi_seq_restore_tracks(
+    fmidi_seq_t *seq, const fmidi_seq_track_state *states, double shift)
+{
+    unsigned ntracks = fmidi_smf_get_info(seq->smf)->track_count;
+
+    seq->queue.clear();
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_seq_track_state &state = states[i];
+        fmidi_seq_track_info &track = seq->track[i];
+        fmidi_seq_timing &timing = *track.timing;
+        track.iter = state.iter;
+        track.tickpos = state.tickpos;
+        track.next = state.next;
+        timing.tempo = state.tempo;
+        timing.segment_tick = state.segment_tick;
+        timing.segment_time = state.segment_time + shift;
+        track.notes_known = false;
     }
 
-    return true;
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_seq_track_info &track = seq->track[i];
+        if (!track.next.event)
+            continue;
+        double time = 0;
+        if (seq->queue_order.by_time)
+            time = fmidi_seq_time_at(seq, *track.timing, track.next.tick);
+        seq->queue.push_back(fmidi_seq_queue_entry{time, track.next.tick, (uint16_t)i});
+    }
+    std::make_heap(seq->queue.begin(), seq->queue.end(), seq->queue_order);
 }
 
-static void fmidi_seq_track_advance_by(
-    fmidi_seq_t *seq, unsigned trkno, double time)
+static void fmidi_seq_restore_checkpoint(fmidi_seq_t *seq, size_t index)
 {
-    const fmidi_smf_t *smf = seq->smf;
-    const fmidi_smf_info_t *info = fmidi_smf_get_info(smf);
-    uint16_t unit = info->delta_unit;
+    unsigned ntracks = fmidi_smf_get_info(seq->smf)->track_count;
+    fmidi_seq_restore_tracks(seq, &seq->checkpoint_tracks[index * ntracks], 0);
+    seq->count = seq->checkpoints[index].count;
+    seq->time = seq->checkpoints[index].time;
+    seq->branched = false;
+    seq->wrapped = false;
+    seq->releases.clear();
+    seq->releases_played = 0;
+}
+
+void fmidi_seq_seek(fmidi_seq_t *seq, double time)
+{
+    const std::vector<fmidi_seq_checkpoint> &checkpoints = seq->checkpoints;
+
+    if (!seq->indexing)
+        fmidi_seq_start_index(seq);
+
+    // the checkpoint preceding the time, if any
+    size_t index = std::lower_bound(
+        checkpoints.begin(), checkpoints.end(), time,
+        [](const fmidi_seq_checkpoint &cp, double time) -> bool
+            { return cp.time < time; }) - checkpoints.begin();
+
+    // go back, unless the current position is already closer
+    fmidi_seq_event_t sqevt;
+    bool ahead = seq->branched ||
+        !fmidi_seq_peek_event(seq, &sqevt) || sqevt.time >= time;
+    bool behind = index > 0 && seq->count < checkpoints[index - 1].count;
+    if (ahead || behind) {
+        if (index > 0)
+            fmidi_seq_restore_checkpoint(seq, index - 1);
+        else
+            fmidi_seq_rewind(seq);
+    }
+
+    while (fmidi_seq_peek_event(seq, &sqevt) && sqevt.time < time)
+        fmidi_seq_next_event(seq, nullptr);
+}
+
+// the time of the event which the queue has first
+static double fmidi_seq_front_time(const fmidi_seq_t *seq)
+{
+    const fmidi_seq_track_info &trk = seq->track[seq->queue.front().track];
+    return fmidi_seq_time_at(seq, *trk.timing, trk.next.tick);
+}
+
+// Returns to the loop start, once the events up to the loop end are played.
+// The restored times are shifted, so the loop start is at the time of the end.
+static void fmidi_seq_loop_back(fmidi_seq_t *seq)
+{
+    const fmidi_loop_t &loop = seq->loop;
+    if (!seq->queue.empty() && seq->queue.front().tick <= loop.end)
+        return;
+
+    // The current times are those of the tempo map, shifted by the previous
+    // repetitions. The shift is found at the current segment, and the times
+    // of the loop points come from the segments which contain them.
+    const fmidi_tempo_map_t *map = seq->loop_map.get();
+    const fmidi_seq_timing &timing = *seq->track[0].timing;
+    double shift = timing.segment_time -
+        fmidi_tempo_map_tick_to_seconds(map, timing.segment_tick);
+    double start_time = fmidi_tempo_map_tick_to_seconds(map, loop.start);
+    double end_time = shift + fmidi_tempo_map_tick_to_seconds(map, loop.end);
+
+    fmidi_seq_restore_tracks(seq, seq->loop_tracks.data(), end_time - start_time);
+    seq->count = seq->loop_count;
+    seq->wrapped = true;
+}
+
+// Turns the note on or off, if the event is a note message.
+static void fmidi_seq_update_notes(fmidi_seq_notes &notes, const fmidi_event_t *evt)
+{
+    if (evt->type != fmidi_event_message || evt->datalen != 3)
+        return;
+    const uint8_t *d = evt->data;
+    unsigned note = ((d[0] & 0x0f) << 7) | (d[1] & 0x7f);
+    if ((d[0] >> 4) == 0b1001 && d[2] != 0)
+        notes.set(note);
+    else if ((d[0] >> 4) == 0b1000 || (d[0] >> 4) == 0b1001)
+        notes.reset(note);
+}
+
+// Finds the notes which are on in a track, after a restored state. The state
+// comes from the sequence of the file, so its notes are those of the file up
+// to the pending event.
+static void fmidi_seq_find_notes(fmidi_seq_t *seq, unsigned trkno)
+{
+    fmidi_seq_track_info &track = seq->track[trkno];
+    track.notes.reset();
+
+    fmidi_track_iter_t it;
+    fmidi_smf_track_begin(&it, trkno);
+    const fmidi_event_t *evt;
+    while ((evt = fmidi_smf_track_next(seq->smf, &it)) && evt != track.next.event)
+        fmidi_seq_update_notes(track.notes, evt);
+
+    track.notes_known = true;
+}
+
+// Plays the event which the queue has first, and reports it.
+static void fmidi_seq_advance(fmidi_seq_t *seq, double time, fmidi_seq_event_t *sqevt)
+{
+    unsigned trkno = seq->queue.front().track;
     fmidi_seq_track_info &trk = seq->track[trkno];
-    fmidi_seq_timing &tim = *trk.timing;
+    const fmidi_event_t *evt = trk.next.event;
+    uint64_t tick = trk.next.tick;
+
+    sqevt->time = time;
+    sqevt->track = trkno;
+    sqevt->event = evt;
+    sqevt->tick = tick;
+
+    fmidi_seq_save_checkpoint(seq, time, tick);
+    ++seq->count;
+    seq->time = time;
+
+    std::pop_heap(seq->queue.begin(), seq->queue.end(), seq->queue_order);
+    seq->queue.pop_back();
+
+    trk.tickpos = tick;
 
-    fmidi_seq_pending_event *evt = fmidi_seq_track_current_event(seq, trkno);
-    if (evt)
-        evt->delta -= fmidi_time_delta(time, unit, tim.tempo);
-    trk.timepos += time;
+    if (evt->type == fmidi_event_message)
+        fmidi_seq_update_notes(trk.notes, evt);
+    else if (evt->type == fmidi_event_meta) {
+        if (evt->data[0] == 0x51 && evt->datalen == 4) {  // set tempo
+            // start a new segment, later times follow the new tempo
+            fmidi_seq_timing &timing = *trk.timing;
+            const uint8_t *d24 = &evt->data[1];
+            timing.segment_tick = tick;
+            timing.segment_time = time;
+            timing.tempo = (d24[0] << 16) | (d24[1] << 8) | d24[2];
+        }
+    }
+
+    fmidi_seq_track_fetch(seq, trkno);
+
+    if (seq->looping)
+        fmidi_seq_loop_back(seq);
+}
+
+// Plays the next of the note-offs of a branch, if any is left.
+static bool fmidi_seq_release(fmidi_seq_t *seq, fmidi_seq_event_t *sqevt)
+{
+    std::vector<fmidi_seq_event_t> &releases = seq->releases;
+    if (seq->releases_played == releases.size())
+        return false;
+
+    *sqevt = releases[seq->releases_played++];
+    if (seq->releases_played == releases.size()) {
+        releases.clear();
+        seq->releases_played = 0;
+    }
+    return true;
 }
 
 bool fmidi_seq_next_event(fmidi_seq_t *seq, fmidi_seq_event_t *sqevt)
@@ -211,31 +545,174 @@ bool fmidi_seq_next_event(fmidi_seq_t *seq, fmidi_seq_event_t *sqevt)
     fmidi_seq_event_t pltmp;
     sqevt = sqevt ? sqevt : &pltmp;
 
-    if (!fmidi_seq_peek_event(seq, sqevt))
+    if (fmidi_seq_release(seq, sqevt))
+        return true;
+
+    if (seq->queue.empty())
         return false;
 
-    double time = sqevt->time;
-    unsigned trkno = sqevt->track;
-    const fmidi_event_t *evt = sqevt->event;
-    fmidi_seq_track_info &trk = seq->track[trkno];
+    fmidi_seq_advance(seq, fmidi_seq_front_time(seq), sqevt);
+    return true;
+}
 
-    const fmidi_smf_t *smf = seq->smf;
-    const fmidi_smf_info_t *info = fmidi_smf_get_info(smf);
-    unsigned ntracks = info->track_count;
-    double elapsed = time - trk.timepos;
+size_t fmidi_seq_next_events(
+    fmidi_seq_t *seq, fmidi_seq_event_t *sqevts, size_t max, double until)
+{
+    size_t count = 0;
+    while (count < max && seq->releases_played < seq->releases.size() &&
+           seq->releases[seq->releases_played].time < until)
+        fmidi_seq_release(seq, &sqevts[count++]);
+    while (count < max && !seq->queue.empty()) {
+        double time = fmidi_seq_front_time(seq);
+        if (time >= until)
+            break;
+        fmidi_seq_advance(seq, time, &sqevts[count++]);
+    }
+    return count;
+}
 
-    for (unsigned i = 0; i < ntracks; ++i)
-        if (i != trkno)
-            fmidi_seq_track_advance_by(seq, i, elapsed);
+bool fmidi_seq_set_loop(fmidi_seq_t *seq, const fmidi_loop_t *loop)
+{
+    seq->looping = false;
+    seq->loop_tracks.clear();
+    fmidi_seq_rewind(seq);
+
+    if (!loop)
+        return true;
+
+    // the loop is on the time line which all tracks share
+    if (seq->queue_order.by_time || loop->start >= loop->end)
+        RET_FAIL(false, fmidi_err_input);
+
+    // the sequence does not go past the loop end, nor does a seek
+    unsigned ntracks = fmidi_smf_get_info(seq->smf)->track_count;
+    std::vector<fmidi_seq_checkpoint> &checkpoints = seq->checkpoints;
+    size_t kept = std::upper_bound(
+        checkpoints.begin(), checkpoints.end(), loop->end,
+        [](uint64_t tick, const fmidi_seq_checkpoint &cp) -> bool
+            { return tick < cp.tick; }) - checkpoints.begin();
+    checkpoints.resize(kept);
+    seq->checkpoint_tracks.resize(kept * ntracks);
+
+    seq->loop_map.reset(fmidi_tempo_map_new(seq->smf, 0));
+
+    // the state before the first event of the loop
+    while (!seq->queue.empty() && seq->queue.front().tick < loop->start)
+        fmidi_seq_next_event(seq, nullptr);
+    if (seq->queue.empty()) {
+        fmidi_seq_rewind(seq);
+        RET_FAIL(false, fmidi_err_input);
+    }
+    fmidi_seq_save_tracks(seq, seq->loop_tracks);
+    seq->loop_count = seq->count;
+    seq->loop = *loop;
+    seq->looping = true;
 
-    if (evt->type == fmidi_event_meta) {
-        if (evt->data[0] == 0x51 && evt->datalen == 4) {  // set tempo
-            const uint8_t *d24 = &evt->data[1];
-            trk.timing->tempo = (d24[0] << 16) | (d24[1] << 8) | d24[2];
+    fmidi_seq_rewind(seq);
+    return true;
+}
+
+// Finds the branch points of all tracks, and their tempo. Only tracks of their
+// own time line can branch, so the tempo comes from the track itself.
+static void fmidi_seq_index_branches(fmidi_seq_t *seq)
+{
+    const fmidi_smf_t *smf = seq->smf;
+    unsigned ntracks = fmidi_smf_get_info(smf)->track_count;
+
+    for (unsigned i = 0; i < ntracks; ++i) {
+        fmidi_track_iter_t it;
+        fmidi_smf_track_begin(&it, i);
+        uint64_t tick = 0;
+        uint32_t tempo = 500000;
+        for (fmidi_track_iter_t at = it; const fmidi_event_t *evt =
+                 fmidi_smf_track_next(smf, &it); at = it) {
+            tick += evt->delta;
+            if (evt->type == fmidi_event_meta) {
+                const uint8_t *d = evt->data;
+                if (d[0] == 0x2f || d[0] == 0x3f)  // end of track
+                    break;
+                if (d[0] == 0x51 && evt->datalen == 4)  // set tempo
+                    tempo = (d[1] << 16) | (d[2] << 8) | d[3];
+            }
+            else if (evt->type == fmidi_event_xmi_branch_point && evt->datalen >= 1) {
+                seq->branches.push_back(fmidi_seq_branch_point{
+                    (uint16_t)i, evt->data[0], at, tick, evt->delta, tempo});
+            }
         }
     }
 
-    trk.timepos = time;
-    trk.next.event = nullptr;
+    // the note-offs, which are released by a branch
+    std::vector<uint8_t> &note_offs = seq->note_offs;
+    for (unsigned note = 0; note < 16 * 128; ++note) {
+        fmidi_event_t *evt = fmidi_event_alloc(note_offs, 3);
+        evt->type = fmidi_event_message;
+        evt->delta = 0;
+        evt->datalen = 3;
+        evt->data[0] = 0x80 | (note >> 7);
+        evt->data[1] = note & 0x7f;
+        evt->data[2] = 64;
+    }
+
+    seq->branches_indexed = true;
+}
+
+bool fmidi_seq_branch(fmidi_seq_t *seq, uint16_t trkno, uint8_t id)
+{
+    const fmidi_smf_info_t *info = fmidi_smf_get_info(seq->smf);
+    if (trkno >= info->track_count)
+        RET_FAIL(false, fmidi_err_input);
+    if (!seq->queue_order.by_time && info->track_count > 1)
+        RET_FAIL(false, fmidi_err_input);
+
+    if (!seq->branches_indexed)
+        fmidi_seq_index_branches(seq);
+
+    const std::vector<fmidi_seq_branch_point> &branches = seq->branches;
+    auto bp = std::find_if(
+        branches.begin(), branches.end(),
+        [trkno, id](const fmidi_seq_branch_point &bp) -> bool
+            { return bp.track == trkno && bp.id == id; });
+    if (bp == branches.end())
+        RET_FAIL(false, fmidi_err_input);
+
+    fmidi_seq_track_info &track = seq->track[trkno];
+    fmidi_seq_timing &timing = *track.timing;
+
+    // the track continues from the current time, which the last event has
+    double now = std::max(seq->time, fmidi_seq_time_at(seq, timing, track.tickpos));
+
+    std::vector<fmidi_seq_queue_entry> &queue = seq->queue;
+    auto entry = std::find_if(
+        queue.begin(), queue.end(),
+        [trkno](const fmidi_seq_queue_entry &ent) -> bool
+            { return ent.track == trkno; });
+    if (entry != queue.end()) {
+        queue.erase(entry);
+        std::make_heap(queue.begin(), queue.end(), seq->queue_order);
+    }
+
+    // the notes which are on are released now, before the branch point
+    if (!track.notes_known)
+        fmidi_seq_find_notes(seq, trkno);
+    const size_t note_off_size = fmidi_event_pad(fmidi_event_sizeof(3));
+    for (unsigned note = 0; note < 16 * 128; ++note) {
+        if (!track.notes.test(note))
+            continue;
+        const fmidi_event_t *evt = (const fmidi_event_t *)
+            &seq->note_offs[note * note_off_size];
+        seq->releases.push_back(fmidi_seq_event_t{now, trkno, evt, track.tickpos});
+    }
+    track.notes.reset();
+    seq->time = now;
+
+    // the branch point plays now, and the events after it keep their timing
+    track.iter = bp->iter;
+    track.tickpos = bp->tick - bp->delta;
+    timing.tempo = bp->tempo;
+    timing.segment_tick = bp->tick;
+    timing.segment_time = now;
+    fmidi_seq_track_fetch(seq, trkno);
+
+    seq->branched = true;
     return true;
 }
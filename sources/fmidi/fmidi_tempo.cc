@@ -0,0 +1,150 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+
+struct fmidi_tempo_map {
+    uint16_t unit;
+    std::vector<fmidi_tempo_segment_t> segments;
+};
+
+static bool fmidi_tempo_is_end_of_track(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_meta &&
+        (evt->data[0] == 0x2f || evt->data[0] == 0x3f);
+}
+
+fmidi_tempo_map_t *fmidi_tempo_map_new(const fmidi_smf_t *smf, uint16_t track)
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    unsigned ntracks = info->track_count;
+
+    // the time lines, as the sequencer has them
+    bool independent = info->format == 2 && ntracks > 1;
+    if (independent && track >= ntracks)
+        RET_FAIL(nullptr, fmidi_err_input);
+    unsigned first_track = independent ? track : 0;
+    unsigned track_count = independent ? 1 : ntracks;
+
+    std::vector<fmidi_tempo_segment_t> changes;
+    fmidi_smpte startoffset;
+    memset(startoffset.code, 0, 5);
+
+    for (unsigned i = first_track; i < first_track + track_count; ++i) {
+        const fmidi_raw_track &trk = smf->track[i];
+        const uint8_t *evdata = trk.data.get();
+        const uint8_t *evend = evdata + trk.length;
+        uint64_t tick = 0;
+        bool leading = true;
+        while (evdata != evend) {
+            const fmidi_event_t *evt = (const fmidi_event_t *)evdata;
+            evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+            tick += evt->delta;
+            if (fmidi_tempo_is_end_of_track(evt))
+                break;
+            leading = leading && tick == 0 && evt->type == fmidi_event_meta;
+            if (evt->type != fmidi_event_meta)
+                continue;
+            const uint8_t *d = evt->data;
+            if (d[0] == 0x51 && evt->datalen == 4) {  // set tempo
+                uint32_t tempo = (d[1] << 16) | (d[2] << 8) | d[3];
+                changes.push_back(fmidi_tempo_segment_t{tick, 0, tempo});
+            }
+            else if (d[0] == 0x54 && evt->datalen == 6) {  // SMPTE offset
+                // disregard SMPTE offset for format 1 MIDI and similar
+                if (independent && leading)
+                    memcpy(startoffset.code, &d[1], 5);
+            }
+        }
+    }
+
+    return fmidi_tempo_map_of_changes(
+        info->delta_unit, fmidi_smpte_time(&startoffset), changes);
+}
+
+fmidi_tempo_map_t *fmidi_tempo_map_of_changes(
+    uint16_t unit, double start, std::vector<fmidi_tempo_segment_t> &changes)
+{
+    std::unique_ptr<fmidi_tempo_map_t> map(new fmidi_tempo_map);
+    map->unit = unit;
+    std::vector<fmidi_tempo_segment_t> &segments = map->segments;
+    segments.swap(changes);
+
+    std::stable_sort(
+        segments.begin(), segments.end(),
+        [](const fmidi_tempo_segment_t &a, const fmidi_tempo_segment_t &b) -> bool
+            { return a.tick < b.tick; });
+    segments.insert(segments.begin(), fmidi_tempo_segment_t{0, start, 500000});
+
+    // the last of tempo changes at the same tick has effect
+    size_t count = 1;
+    for (size_t i = 1, n = segments.size(); i < n; ++i) {
+        const fmidi_tempo_segment_t &seg = segments[i];
+        fmidi_tempo_segment_t &prev = segments[count - 1];
+        if (seg.tick == prev.tick)
+            prev.tempo = seg.tempo;
+        else {
+            double time = prev.time + fmidi_delta_time(seg.tick - prev.tick, map->unit, prev.tempo);
+            segments[count++] = fmidi_tempo_segment_t{seg.tick, time, seg.tempo};
+        }
+    }
+    segments.resize(count);
+    segments.shrink_to_fit();
+
+    return map.release();
+}
+
+void fmidi_tempo_map_free(fmidi_tempo_map_t *map)
+{
+    delete map;
+}
+
+const fmidi_tempo_segment_t *fmidi_tempo_map_segments(
+    const fmidi_tempo_map_t *map, size_t *count)
+{
+    *count = map->segments.size();
+    return map->segments.data();
+}
+
+static const fmidi_tempo_segment_t &fmidi_tempo_map_find_tick(
+    const fmidi_tempo_map_t *map, uint64_t tick)
+{
+    const std::vector<fmidi_tempo_segment_t> &segments = map->segments;
+    auto it = std::upper_bound(
+        segments.begin(), segments.end(), tick,
+        [](uint64_t tick, const fmidi_tempo_segment_t &seg) -> bool
+            { return tick < seg.tick; });
+    return *(it - 1);  // the first segment is at tick 0
+}
+
+double fmidi_tempo_map_tick_to_seconds(const fmidi_tempo_map_t *map, uint64_t tick)
+{
+    const fmidi_tempo_segment_t &seg = fmidi_tempo_map_find_tick(map, tick);
+    return seg.time + fmidi_delta_time(tick - seg.tick, map->unit, seg.tempo);
+}
+
+double fmidi_tempo_map_seconds_to_tick(const fmidi_tempo_map_t *map, double time)
+{
+    const std::vector<fmidi_tempo_segment_t> &segments = map->segments;
+    if (time <= segments[0].time)
+        return 0;
+    auto it = std::upper_bound(
+        segments.begin(), segments.end(), time,
+        [](double time, const fmidi_tempo_segment_t &seg) -> bool
+            { return time < seg.time; });
+    const fmidi_tempo_segment_t &seg = *(it - 1);
+    return seg.tick + fmidi_time_delta(time - seg.time, map->unit, seg.tempo);
+}
+
+uint32_t fmidi_tempo_map_tempo_at(const fmidi_tempo_map_t *map, uint64_t tick)
+{
+    return fmidi_tempo_map_find_tick(map, tick).tempo;
+}
@@ -0,0 +1,371 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "fmidi/fmidi.h"
+#include "fmidi/fmidi_util.h"
+#include "fmidi/fmidi_internal.h"
+#include "fmidi/u_parallel.h"
+#include "fmidi/u_hash.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct fmidi_timeline {
+    const fmidi_smf_t *smf;
+    std::vector<fmidi_timeline_entry_t> entries;
+};
+
+// the size of the parts of a merge, which run in parallel
+static constexpr size_t fmidi_timeline_merge_grain = 1 << 16;
+
+static bool fmidi_timeline_is_end_of_track(const fmidi_event_t *evt)
+{
+    return evt->type == fmidi_event_meta &&
+        (evt->data[0] == 0x2f || evt->data[0] == 0x3f);
+}
+
+// The order of the sequencer: by time, then by tick if the tracks share their
+// timing, then by track. Independent tracks have unrelated ticks.
+struct fmidi_timeline_less {
+    bool independent;
+    bool operator()(const fmidi_timeline_entry_t &a, const fmidi_timeline_entry_t &b) const
+    {
+        if (a.time != b.time)
+            return a.time < b.time;
+        if (!independent && a.tick != b.tick)
+            return a.tick < b.tick;
+        return a.track < b.track;
+    }
+};
+
+// the number of events which the sequencer plays from the track
+static size_t fmidi_timeline_track_count(const fmidi_raw_track &trk)
+{
+    const uint8_t *evdata = trk.data.get();
+    const uint8_t *evend = evdata + trk.length;
+    size_t count = 0;
+    while (evdata != evend) {
+        const fmidi_event_t *evt = (const fmidi_event_t *)evdata;
+        if (fmidi_timeline_is_end_of_track(evt))
+            break;
+        evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+        ++count;
+    }
+    return count;
+}
+
+static void fmidi_timeline_track_fill(
+    const fmidi_raw_track &trk, uint16_t trkno, const fmidi_tempo_map_t *map,
+    uint16_t unit, fmidi_timeline_entry_t *entries)
+{
+    size_t nsegs;
+    const fmidi_tempo_segment_t *segs = fmidi_tempo_map_segments(map, &nsegs);
+    size_t segno = 0;
+
+    const uint8_t *evdata = trk.data.get();
+    const uint8_t *evend = evdata + trk.length;
+    uint64_t tick = 0;
+    while (evdata != evend) {
+        const fmidi_event_t *evt = (const fmidi_event_t *)evdata;
+        if (fmidi_timeline_is_end_of_track(evt))
+            break;
+        evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+        tick += evt->delta;
+        while (segno + 1 < nsegs && segs[segno + 1].tick <= tick)
+            ++segno;
+        const fmidi_tempo_segment_t &seg = segs[segno];
+        double time = seg.time + fmidi_delta_time(tick - seg.tick, unit, seg.tempo);
+        *entries++ = fmidi_timeline_entry_t{(uint64_t)llround(time * 1e6), tick, trkno, evt};
+    }
+}
+
+// Finds how many elements of the first range are among the first k elements of
+// the merge of both ranges, the first range coming first on equality.
+static size_t fmidi_timeline_co_rank(
+    size_t k, const fmidi_timeline_entry_t *a, size_t m,
+    const fmidi_timeline_entry_t *b, size_t n, fmidi_timeline_less less)
+{
+    size_t lo = (k > n) ? (k - n) : 0;
+    size_t hi = std::min(k, m);
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        size_t j = k - i;
+        if (j == 0 || less(b[j - 1], a[i]))
+            hi = i;
+        else
+            lo = i + 1;
+    }
+    return lo;
+}
+
+// a part of the merge of two adjacent runs, into positions [first, last)
+struct fmidi_timeline_merge_job {
+    size_t begin, middle, end;
+    size_t first, last;
+};
+
+// Merges the sorted runs delimited by the bounds. Each round merges the runs
+// by pairs, and the merges are split in parts of similar size which proceed in
+// parallel, so that the last rounds use the threads as well as the first.
+static void fmidi_timeline_merge(
+    std::vector<fmidi_timeline_entry_t> &entries, std::vector<size_t> bounds,
+    fmidi_timeline_less less)
+{
+    if (bounds.size() <= 2)
+        return;
+
+    std::vector<fmidi_timeline_entry_t> other(entries.size());
+    std::vector<fmidi_timeline_merge_job> jobs;
+
+    while (bounds.size() > 2) {
+        std::vector<size_t> next_bounds;
+        jobs.clear();
+        for (size_t r = 0; r + 1 < bounds.size(); r += 2) {
+            size_t begin = bounds[r];
+            size_t middle = bounds[r + 1];
+            size_t end = (r + 2 < bounds.size()) ? bounds[r + 2] : middle;
+            next_bounds.push_back(begin);
+            for (size_t first = begin; first < end; first += fmidi_timeline_merge_grain) {
+                size_t last = std::min(end, first + fmidi_timeline_merge_grain);
+                jobs.push_back(fmidi_timeline_merge_job{begin, middle, end, first, last});
+            }
+        }
+        next_bounds.push_back(entries.size());
+
+        const fmidi_timeline_entry_t *src = entries.data();
+        fmidi_timeline_entry_t *dst = other.data();
+        fmidi_parallel_for(jobs.size(), entries.size(), [&jobs, src, dst, less](size_t index) {
+            const fmidi_timeline_merge_job &job = jobs[index];
+            const fmidi_timeline_entry_t *a = src + job.begin;
+            const fmidi_timeline_entry_t *b = src + job.middle;
+            size_t m = job.middle - job.begin;
+            size_t n = job.end - job.middle;
+            size_t i0 = fmidi_timeline_co_rank(job.first - job.begin, a, m, b, n, less);
+            size_t i1 = fmidi_timeline_co_rank(job.last - job.begin, a, m, b, n, less);
+            size_t j0 = job.first - job.begin - i0;
+            size_t j1 = job.last - job.begin - i1;
+            std::merge(a + i0, a + i1, b + j0, b + j1, dst + job.first, less);
+        });
+
+        entries.swap(other);
+        bounds.swap(next_bounds);
+    }
+}
+
+fmidi_timeline_t *fmidi_timeline_new(const fmidi_smf_t *smf)
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    uint16_t ntracks = info->track_count;
+    bool independent = info->format == 2 && ntracks > 1;
+
+    std::vector<fmidi_tempo_map_u> maps(independent ? ntracks : 1);
+    for (unsigned i = 0; i < maps.size(); ++i) {
+        maps[i].reset(fmidi_tempo_map_new(smf, i));
+        if (!maps[i])
+            return nullptr;
+    }
+
+    // the runs of the tracks, each in order of time already
+    std::vector<size_t> bounds(ntracks + 1);
+    for (unsigned i = 0; i < ntracks; ++i)
+        bounds[i + 1] = bounds[i] + fmidi_timeline_track_count(smf->track[i]);
+
+    std::unique_ptr<fmidi_timeline_t> tl(new fmidi_timeline_t);
+    tl->smf = smf;
+    std::vector<fmidi_timeline_entry_t> &entries = tl->entries;
+    entries.resize(bounds[ntracks]);
+
+    fmidi_parallel_for(ntracks, entries.size(), [&](size_t i) {
+        const fmidi_tempo_map_t *map = maps[independent ? i : 0].get();
+        fmidi_timeline_track_fill(
+            smf->track[i], i, map, info->delta_unit, entries.data() + bounds[i]);
+    });
+
+    fmidi_timeline_merge(entries, std::move(bounds), fmidi_timeline_less{independent});
+    return tl.release();
+}
+
+void fmidi_timeline_free(fmidi_timeline_t *tl)
+{
+    delete tl;
+}
+
+const fmidi_timeline_entry_t *fmidi_timeline_entries(
+    const fmidi_timeline_t *tl, size_t *count)
+{
+    *count = tl->entries.size();
+    return tl->entries.data();
+}
+
+size_t fmidi_timeline_find(const fmidi_timeline_t *tl, uint64_t time)
+{
+    const std::vector<fmidi_timeline_entry_t> &entries = tl->entries;
+    return std::lower_bound(
+        entries.begin(), entries.end(), time,
+        [](const fmidi_timeline_entry_t &entry, uint64_t time) -> bool
+            { return entry.time < time; }) - entries.begin();
+}
+
+//------------------------------------------------------------------------------
+// Saved timeline: the magic "FMTL", the version, the digest of the file,
+// the entry count, then for each entry the time, the tick and the track. All
+// numbers are in little endian. The events are implied by the order of the
+// entries in each track, and they are located again when reading.
+
+static constexpr uint32_t fmidi_timeline_version = 1;
+static constexpr size_t fmidi_timeline_header_size = 4 + 4 + 16 + 8;
+static constexpr size_t fmidi_timeline_entry_size = 8 + 8 + 2;
+
+static uint8_t *fmidi_timeline_put(uint8_t *p, uint64_t value, unsigned size)
+{
+    for (unsigned i = 0; i < size; ++i)
+        *p++ = (uint8_t)(value >> (8 * i));
+    return p;
+}
+
+static uint64_t fmidi_timeline_get(const uint8_t *&p, unsigned size)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < size; ++i)
+        value |= (uint64_t)*p++ << (8 * i);
+    return value;
+}
+
+// Hashes the contents of the events, rather than their representation in
+// memory, so the digest does not depend on the platform.
+static void fmidi_timeline_digest(const fmidi_smf_t *smf, uint8_t digest[16])
+{
+    const fmidi_smf_info_t *info = &smf->info;
+    murmur3_128 hash;
+    uint8_t buf[9];
+
+    fmidi_timeline_put(buf, info->format, 2);
+    fmidi_timeline_put(buf + 2, info->track_count, 2);
+    fmidi_timeline_put(buf + 4, info->delta_unit, 2);
+    hash.update(buf, 6);
+
+    for (unsigned i = 0, n = info->track_count; i < n; ++i) {
+        const fmidi_raw_track &trk = smf->track[i];
+        const uint8_t *evdata = trk.data.get();
+        const uint8_t *evend = evdata + trk.length;
+        while (evdata != evend) {
+            const fmidi_event_t *evt = (const fmidi_event_t *)evdata;
+            evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+            buf[0] = (uint8_t)evt->type;
+            fmidi_timeline_put(buf + 1, evt->delta, 4);
+            fmidi_timeline_put(buf + 5, evt->datalen, 4);
+            hash.update(buf, 9);
+            hash.update(evt->data, evt->datalen);
+        }
+        hash.update_byte(0xff);  // the track separator
+    }
+
+    hash.finish(digest);
+}
+
+bool fmidi_timeline_mem_write(
+    const fmidi_timeline_t *tl, uint8_t **data, size_t *length)
+{
+    const std::vector<fmidi_timeline_entry_t> &entries = tl->entries;
+    size_t size = fmidi_timeline_header_size +
+        entries.size() * fmidi_timeline_entry_size;
+
+    uint8_t *mem = (uint8_t *)malloc(size);
+    if (!mem)
+        RET_FAIL(false, fmidi_err_output);
+
+    uint8_t *p = mem;
+    memcpy(p, "FMTL", 4);
+    p = fmidi_timeline_put(p + 4, fmidi_timeline_version, 4);
+    fmidi_timeline_digest(tl->smf, p);
+    p = fmidi_timeline_put(p + 16, entries.size(), 8);
+    for (const fmidi_timeline_entry_t &entry : entries) {
+        p = fmidi_timeline_put(p, entry.time, 8);
+        p = fmidi_timeline_put(p, entry.tick, 8);
+        p = fmidi_timeline_put(p, entry.track, 2);
+    }
+
+    *data = mem;
+    *length = size;
+    return true;
+}
+
+// the position of the sequencer in a track, while reading
+struct fmidi_timeline_cursor {
+    const uint8_t *evdata;
+    const uint8_t *evend;
+    uint64_t tick;
+};
+
+fmidi_timeline_t *fmidi_timeline_mem_read(
+    const fmidi_smf_t *smf, const uint8_t *data, size_t length)
+{
+    const uint8_t *p = data;
+    if (length < fmidi_timeline_header_size)
+        RET_FAIL(nullptr, fmidi_err_eof);
+    if (memcmp(p, "FMTL", 4) != 0)
+        RET_FAIL(nullptr, fmidi_err_format);
+    p += 4;
+    if (fmidi_timeline_get(p, 4) != fmidi_timeline_version)
+        RET_FAIL(nullptr, fmidi_err_format);
+
+    uint8_t digest[16];
+    fmidi_timeline_digest(smf, digest);
+    if (memcmp(p, digest, 16) != 0)
+        RET_FAIL(nullptr, fmidi_err_input);
+    p += 16;
+
+    uint64_t count = fmidi_timeline_get(p, 8);
+    if (count > (length - fmidi_timeline_header_size) / fmidi_timeline_entry_size)
+        RET_FAIL(nullptr, fmidi_err_eof);
+
+    uint16_t ntracks = smf->info.track_count;
+    std::unique_ptr<fmidi_timeline_cursor[]> cursors(new fmidi_timeline_cursor[ntracks]);
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_raw_track &trk = smf->track[i];
+        fmidi_timeline_cursor &cur = cursors[i];
+        cur.evdata = trk.data.get();
+        cur.evend = cur.evdata + trk.length;
+        cur.tick = 0;
+    }
+
+    std::unique_ptr<fmidi_timeline_t> tl(new fmidi_timeline_t);
+    tl->smf = smf;
+    std::vector<fmidi_timeline_entry_t> &entries = tl->entries;
+    entries.resize(count);
+
+    // the entries must have the events of each track, in track order
+    uint64_t lasttime = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        fmidi_timeline_entry_t &entry = entries[i];
+        entry.time = fmidi_timeline_get(p, 8);
+        entry.tick = fmidi_timeline_get(p, 8);
+        entry.track = fmidi_timeline_get(p, 2);
+        if (entry.track >= ntracks || entry.time < lasttime)
+            RET_FAIL(nullptr, fmidi_err_format);
+        fmidi_timeline_cursor &cur = cursors[entry.track];
+        if (cur.evdata == cur.evend)
+            RET_FAIL(nullptr, fmidi_err_format);
+        const fmidi_event_t *evt = (const fmidi_event_t *)cur.evdata;
+        if (fmidi_timeline_is_end_of_track(evt) || entry.tick != cur.tick + evt->delta)
+            RET_FAIL(nullptr, fmidi_err_format);
+        cur.evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+        cur.tick = entry.tick;
+        entry.event = evt;
+        lasttime = entry.time;
+    }
+
+    for (unsigned i = 0; i < ntracks; ++i) {
+        const fmidi_timeline_cursor &cur = cursors[i];
+        if (cur.evdata != cur.evend &&
+            !fmidi_timeline_is_end_of_track((const fmidi_event_t *)cur.evdata))
+            RET_FAIL(nullptr, fmidi_err_format);
+    }
+
+    return tl.release();
+}
@@ -8,6 +8,8 @@
 #include "fmidi/u_memstream.h"
 #include "fmidi/u_iterator.h"
 #include <string>
+#include <algorithm>
+#include <string.h>
 
 double fmidi_smpte_time(const fmidi_smpte *smpte)
 {
@@ -25,6 +27,8 @@ double fmidi_delta_time(double delta, uint16_t unit, uint32_t tempo)
     if (unit & (1 << 15)) {
         unsigned tpf = unit & 0xff;  // delta units per frame
         unsigned fps = -(int8_t)(unit >> 8);  // frames per second
+        if (fps == 29)  // 30 drop-frame
+            return delta * 1001 / (tpf * 30000.0);
         return delta / (tpf * fps);
     }
     else {
@@ -39,6 +43,8 @@ double fmidi_time_delta(double time, uint16_t unit, uint32_t tempo)
     if (unit & (1 << 15)) {
         unsigned tpf = unit & 0xff;  // delta units per frame
         unsigned fps = -(int8_t)(unit >> 8);  // frames per second
+        if (fps == 29)  // 30 drop-frame
+            return time * (tpf * 30000.0) / 1001;
         return time * (tpf * fps);
     }
     else {
@@ -59,6 +65,28 @@ fmidi_event_t *fmidi_event_alloc(std::vector<uint8_t> &buf, uint32_t datalen)
     return event;
 }
 
+fmidi_event_t *fmidi_event_alloc(fmidi_event_arena &buf, uint32_t datalen)
+{
+    size_t pos = buf.length;
+    size_t evsize = fmidi_event_sizeof(datalen);
+    size_t padsize = fmidi_event_pad(evsize);
+    if (padsize > UINT32_MAX - pos)
+        return nullptr;
+    if (pos + padsize > buf.capacity) {
+        size_t capacity = std::max<size_t>(
+            pos + padsize, std::min<size_t>(2 * (size_t)buf.capacity, UINT32_MAX));
+        capacity = std::max<size_t>(capacity, 256);
+        uint8_t *data = new uint8_t[capacity];
+        if (pos > 0)
+            memcpy(data, buf.data.get(), pos);
+        buf.data.reset(data);
+        buf.capacity = capacity;
+    }
+    buf.length = pos + padsize;
+    fmidi_event_t *event = (fmidi_event_t *)&buf.data[pos];
+    return event;
+}
+
 unsigned fmidi_message_sizeof(uint8_t id)
 {
     if ((id >> 7) == 0) {
@@ -5,21 +5,41 @@
 
 #include "fmidi/fmidi.h"
 #include <vector>
+#include <memory>
+#include <atomic>
 
 struct fmidi_raw_track {
-    std::unique_ptr<uint8_t[]> data;
+    // shared between derived files, allocated with new[]
+    std::shared_ptr<uint8_t> data;
     uint32_t length;
 };
 
 struct fmidi_smf {
     fmidi_smf_info_t info;
     std::unique_ptr<fmidi_raw_track[]> track;
+    // the computed duration, as the bits of a double, all ones if unknown
+    mutable std::atomic<uint64_t> duration{~(uint64_t)0};
+};
+
+// growable event storage, which can be released as track data
+struct fmidi_event_arena {
+    std::unique_ptr<uint8_t[]> data;
+    uint32_t length = 0;
+    uint32_t capacity = 0;
 };
 
 //------------------------------------------------------------------------------
 uintptr_t fmidi_event_pad(uintptr_t size);
 fmidi_event_t *fmidi_event_alloc(std::vector<uint8_t> &buf, uint32_t datalen);
+fmidi_event_t *fmidi_event_alloc(fmidi_event_arena &buf, uint32_t datalen);
+void fmidi_raw_track_assign(fmidi_raw_track &trk, uint8_t *data, uint32_t length);
+size_t fmidi_raw_track_event_count(const fmidi_raw_track &trk);
+void fmidi_smf_modified(fmidi_smf_t *smf);
 unsigned fmidi_message_sizeof(uint8_t id);
+// Makes the tempo map of a time line from its tempo changes, by tick, in order
+// of the tracks, the time line starting at the given time. Consumes the changes.
+fmidi_tempo_map_t *fmidi_tempo_map_of_changes(
+    uint16_t unit, double start, std::vector<fmidi_tempo_segment_t> &changes);
 
 //------------------------------------------------------------------------------
 inline uintptr_t fmidi_event_pad(uintptr_t size)
@@ -27,3 +47,27 @@ inline uintptr_t fmidi_event_pad(uintptr_t size)
     uintptr_t nb = size % alignof(fmidi_event_t);
     return nb ? (size + alignof(fmidi_event_t) - nb) : size;
 }
+
+inline void fmidi_raw_track_assign(fmidi_raw_track &trk, uint8_t *data, uint32_t length)
+{
+    trk.data.reset(data, std::default_delete<uint8_t[]>());
+    trk.length = length;
+}
+
+inline size_t fmidi_raw_track_event_count(const fmidi_raw_track &trk)
+{
+    const uint8_t *evdata = trk.data.get();
+    const uint8_t *evend = evdata + trk.length;
+    size_t count = 0;
+    for (; evdata != evend; ++count) {
+        const fmidi_event_t *evt = (const fmidi_event_t *)evdata;
+        evdata += fmidi_event_pad(fmidi_event_sizeof(evt->datalen));
+    }
+    return count;
+}
+
+// forgets the information computed from the contents, which have changed
+inline void fmidi_smf_modified(fmidi_smf_t *smf)
+{
+    smf->duration.store(~(uint64_t)0, std::memory_order_relaxed);
+}
@@ -0,0 +1,132 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "u_hash.h"
+#include <string.h>
+
+static constexpr uint64_t c1 = UINT64_C(0x87c37b91114253d5);
+static constexpr uint64_t c2 = UINT64_C(0x4cf5ad432745937f);
+
+static inline uint64_t rotl64(uint64_t x, unsigned r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= UINT64_C(0xff51afd7ed558ccd);
+    k ^= k >> 33;
+    k *= UINT64_C(0xc4ceb9fe1a85ec53);
+    k ^= k >> 33;
+    return k;
+}
+
+// reads in little endian, whichever the host
+static inline uint64_t load64(const uint8_t *p)
+{
+    uint64_t x = 0;
+    for (unsigned i = 8; i-- > 0;)
+        x = (x << 8) | p[i];
+    return x;
+}
+
+static inline void store64(uint8_t *p, uint64_t x)
+{
+    for (unsigned i = 0; i < 8; ++i, x >>= 8)
+        p[i] = (uint8_t)x;
+}
+
+murmur3_128::murmur3_128(uint64_t seed)
+    : h1_(seed), h2_(seed)
+{
+}
+
+void murmur3_128::block(const uint8_t *data)
+{
+    uint64_t k1 = load64(data);
+    uint64_t k2 = load64(data + 8);
+
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1_ ^= k1;
+    h1_ = rotl64(h1_, 27); h1_ += h2_; h1_ = h1_ * 5 + 0x52dce729;
+
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2_ ^= k2;
+    h2_ = rotl64(h2_, 31); h2_ += h1_; h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+void murmur3_128::update(const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    total_ += length;
+
+    if (tail_length_ > 0) {
+        size_t count = 16 - tail_length_;
+        if (count > length)
+            count = length;
+        memcpy(tail_ + tail_length_, bytes, count);
+        tail_length_ += count;
+        bytes += count;
+        length -= count;
+        if (tail_length_ < 16)
+            return;
+        block(tail_);
+        tail_length_ = 0;
+    }
+
+    for (; length >= 16; bytes += 16, length -= 16)
+        block(bytes);
+
+    memcpy(tail_, bytes, length);
+    tail_length_ = length;
+}
+
+void murmur3_128::update_byte(uint8_t byte)
+{
+    ++total_;
+    tail_[tail_length_++] = byte;
+    if (tail_length_ == 16) {
+        block(tail_);
+        tail_length_ = 0;
+    }
+}
+
+void murmur3_128::finish(uint8_t digest[16])
+{
+    uint64_t k1 = 0, k2 = 0;
+    const uint8_t *tail = tail_;
+
+    switch (tail_length_) {
+    case 15: k2 ^= (uint64_t)tail[14] << 48; // fall through
+    case 14: k2 ^= (uint64_t)tail[13] << 40; // fall through
+    case 13: k2 ^= (uint64_t)tail[12] << 32; // fall through
+    case 12: k2 ^= (uint64_t)tail[11] << 24; // fall through
+    case 11: k2 ^= (uint64_t)tail[10] << 16; // fall through
+    case 10: k2 ^= (uint64_t)tail[9] << 8; // fall through
+    case 9: k2 ^= (uint64_t)tail[8];
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2_ ^= k2;
+        // fall through
+    case 8: k1 ^= (uint64_t)tail[7] << 56; // fall through
+    case 7: k1 ^= (uint64_t)tail[6] << 48; // fall through
+    case 6: k1 ^= (uint64_t)tail[5] << 40; // fall through
+    case 5: k1 ^= (uint64_t)tail[4] << 32; // fall through
+    case 4: k1 ^= (uint64_t)tail[3] << 24; // fall through
+    case 3: k1 ^= (uint64_t)tail[2] << 16; // fall through
+    case 2: k1 ^= (uint64_t)tail[1] << 8; // fall through
+    case 1: k1 ^= (uint64_t)tail[0];
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1_ ^= k1;
+    }
+
+    uint64_t h1 = h1_ ^ total_;
+    uint64_t h2 = h2_ ^ total_;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    store64(digest, h1);
+    store64(digest + 8, h2);
+}
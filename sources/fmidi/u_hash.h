@@ -0,0 +1,32 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//////////////////
+// MURMUR3 HASH //
+//////////////////
+
+// MurmurHash3 x64 128-bit, computed incrementally. The result is identical to
+// hashing the concatenation of all the updates at once.
+class murmur3_128 {
+public:
+    explicit murmur3_128(uint64_t seed = 0);
+    void update(const void *data, size_t length);
+    void update_byte(uint8_t byte);
+    // writes the hash as two 64-bit words in little endian
+    void finish(uint8_t digest[16]);
+
+private:
+    void block(const uint8_t *data);
+
+private:
+    uint64_t h1_ = 0, h2_ = 0;
+    uint64_t total_ = 0;
+    uint8_t tail_[16];
+    size_t tail_length_ = 0;
+};
@@ -0,0 +1,69 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "u_parallel.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+void fmidi_parallel_for(size_t count, const std::function<void(size_t)> &fn)
+{
+    size_t nthreads = std::min<size_t>(std::thread::hardware_concurrency(), count);
+
+    if (nthreads < 2) {
+        for (size_t i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&]() {
+        for (size_t i; (i = next.fetch_add(1)) < count;) {
+            try {
+                fn(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+                next.store(count);
+            }
+        }
+    };
+
+    // if the threads cannot all be started, those which are share the work,
+    // possibly leaving the calling thread alone
+    std::vector<std::thread> workers;
+    try {
+        workers.reserve(nthreads - 1);
+        for (size_t i = 0; i < nthreads - 1; ++i)
+            workers.emplace_back(work);
+    }
+    catch (...) {
+    }
+    work();
+    for (std::thread &worker : workers)
+        worker.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void fmidi_parallel_for(size_t count, size_t events, const std::function<void(size_t)> &fn)
+{
+    if (events < fmidi_parallel_min_events) {
+        for (size_t i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+
+    fmidi_parallel_for(count, fn);
+}
@@ -0,0 +1,23 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <functional>
+#include <stddef.h>
+
+//////////////////
+// PARALLEL FOR //
+//////////////////
+
+// the least count of events to process which repays starting the threads
+static constexpr size_t fmidi_parallel_min_events = 1 << 16;
+
+// Calls the function for each index in [0, count), distributing the calls on
+// worker threads. The first exception raised by a call is rethrown. A failure to
+// start the threads is not an error, the calls are then made on fewer threads.
+void fmidi_parallel_for(size_t count, const std::function<void(size_t)> &fn);
+// Calls the function likewise, but serially if the calls process in all less
+// events than repay the threads.
+void fmidi_parallel_for(size_t count, size_t events, const std::function<void(size_t)> &fn);
@@ -0,0 +1,46 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <vector>
+
+static bool append(fmidi_smf_builder_t *bld, std::initializer_list<uint8_t> bytes)
+{
+    std::vector<uint8_t> data(bytes);
+    return fmidi_smf_builder_append(
+        bld, 0, fmidi_event_message, 0, data.data(), data.size());
+}
+
+int main()
+{
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(0, 96));
+    fmidi_smf_builder_add_track(bld.get());
+
+    // the messages which have an encoding in a file
+    CHECK(append(bld.get(), {0x90, 60, 100}));
+    CHECK(append(bld.get(), {0xc0, 5}));
+    CHECK(append(bld.get(), {0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7}));
+    CHECK(append(bld.get(), {0xf2, 0x10, 0x20}));
+
+    // and those which do not
+    CHECK(!append(bld.get(), {}));
+    CHECK(!append(bld.get(), {60, 100}));
+    CHECK(!append(bld.get(), {0x90, 60}));
+    CHECK(!append(bld.get(), {0x90, 60, 100, 0}));
+    CHECK(!append(bld.get(), {0x90, 60, 0x80}));
+    CHECK(!append(bld.get(), {0xf0, 0x7e, 0x7f}));
+    CHECK(!append(bld.get(), {0xf0, 0x7e, 0x90, 0xf7}));
+    CHECK(!append(bld.get(), {0xf7, 0x01}));
+    CHECK(!append(bld.get(), {0xff}));
+    CHECK(fmidi_errno() == fmidi_err_input);
+
+    fmidi_builder_event_t bad = {0, fmidi_event_message, (const uint8_t *)"\x90\x3c", 2};
+    CHECK(!fmidi_smf_builder_insert(bld.get(), 0, &bad, 1));
+
+    fmidi_smf_u smf(fmidi_smf_builder_finish(bld.get()));
+    CHECK(smf);
+
+    return test_failures != 0;
+}
@@ -0,0 +1,98 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <vector>
+#include <string.h>
+
+// the first bytes of the events of the canonical form, of a single track
+static std::vector<uint8_t> canonical_statuses(fmidi_smf_builder_t *bld)
+{
+    fmidi_smf_u smf(fmidi_smf_builder_finish(bld));
+    fmidi_smf_u out(fmidi_smf_canonicalize(smf.get()));
+    std::vector<uint8_t> statuses;
+    fmidi_track_iter_t it;
+    fmidi_smf_track_begin(&it, 0);
+    while (const fmidi_event_t *evt = fmidi_smf_track_next(out.get(), &it))
+        statuses.push_back(evt->data[0]);
+    return statuses;
+}
+
+static void hash(fmidi_smf_builder_t *bld, uint8_t digest[16])
+{
+    fmidi_smf_u smf(fmidi_smf_builder_finish(bld));
+    fmidi_smf_hash(smf.get(), digest);
+}
+
+int main()
+{
+    // the tracks of a tick are ordered by contents, then the channel messages
+    // are ordered by channel, without crossing the system exclusive and the
+    // meta events, and keeping their order within a channel
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(1, 96));
+    fmidi_smf_builder_add_track(bld.get());
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x92, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xb1, 7, 100});
+    test_append(bld.get(), 1, fmidi_event_message, 0, {0x91, 60, 100});
+    test_append(bld.get(), 1, fmidi_event_message, 0, {0x81, 60, 0});
+    test_append(bld.get(), 1, fmidi_event_meta, 0, {0x06, 'x'});
+    test_append(bld.get(), 1, fmidi_event_message, 0, {0xc3, 5});
+    test_append(bld.get(), 1, fmidi_event_message, 0, {0xc0, 5});
+    std::vector<uint8_t> statuses = canonical_statuses(bld.get());
+    const uint8_t expected[] = {
+        0x91, 0x81, 0x06, 0xc0, 0x90, 0x92, 0xc3, 0xf0, 0xb1, 0x2f,
+    };
+    CHECK(statuses.size() == sizeof(expected) &&
+          !memcmp(statuses.data(), expected, sizeof(expected)));
+
+    // the layout and the numbering of tracks do not matter, the order of
+    // playback within a track does
+    uint8_t digest[4][16];
+    fmidi_smf_builder_add_track(bld.get());
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xf0, 0x41, 0xf7});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x90, 60, 100});
+    test_append(bld.get(), 1, fmidi_event_message, 0, {0x91, 60, 100});
+    hash(bld.get(), digest[0]);
+    fmidi_smf_builder_add_track(bld.get());
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x91, 60, 100});
+    test_append(bld.get(), 1, fmidi_event_message, 0, {0xf0, 0x41, 0xf7});
+    test_append(bld.get(), 1, fmidi_event_message, 0, {0x90, 60, 100});
+    hash(bld.get(), digest[1]);
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x91, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xf0, 0x41, 0xf7});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x90, 60, 100});
+    hash(bld.get(), digest[2]);
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xf0, 0x41, 0xf7});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x91, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x90, 60, 100});
+    hash(bld.get(), digest[3]);
+    CHECK(!memcmp(digest[0], digest[1], 16));
+    CHECK(!memcmp(digest[0], digest[2], 16));
+    CHECK(memcmp(digest[0], digest[3], 16));
+
+    // instrument tracks, which start with a name, swapped
+    for (unsigned swap = 0; swap < 2; ++swap) {
+        fmidi_smf_builder_add_track(bld.get());
+        fmidi_smf_builder_add_track(bld.get());
+        for (unsigned i = 0; i < 2; ++i) {
+            unsigned trk = i ^ swap;
+            test_append(bld.get(), trk, fmidi_event_meta, 0, {0x03, (uint8_t)('a' + i)});
+            test_append(bld.get(), trk, fmidi_event_message, 0, {(uint8_t)(0xc0 + i), (uint8_t)(10 * i)});
+            test_append(bld.get(), trk, fmidi_event_message, 0, {(uint8_t)(0x90 + i), 60, 100});
+            test_append(bld.get(), trk, fmidi_event_message, 96, {(uint8_t)(0x80 + i), 60, 64});
+        }
+        hash(bld.get(), digest[swap]);
+    }
+    CHECK(!memcmp(digest[0], digest[1], 16));
+
+    return test_failures != 0;
+}
@@ -0,0 +1,87 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <vector>
+
+struct Tick_Event {
+    uint64_t tick;
+    const fmidi_event_t *event;
+};
+
+// the events of the optimized single track, with their ticks, and a new track
+// in the builder
+static std::vector<Tick_Event> optimize(fmidi_smf_builder_t *bld, fmidi_smf_u &out)
+{
+    fmidi_smf_u smf(fmidi_smf_builder_finish(bld));
+    fmidi_smf_builder_add_track(bld);
+    out.reset(fmidi_smf_optimize(smf.get(), fmidi_optimize_empty_notes, nullptr));
+    std::vector<Tick_Event> events;
+    fmidi_track_iter_t it;
+    fmidi_smf_track_begin(&it, 0);
+    uint64_t tick = 0;
+    while (const fmidi_event_t *evt = fmidi_smf_track_next(out.get(), &it)) {
+        tick += evt->delta;
+        events.push_back(Tick_Event{tick, evt});
+    }
+    return events;
+}
+
+static bool is_note(const Tick_Event &ev, uint64_t tick, uint8_t status)
+{
+    const fmidi_event_t *evt = ev.event;
+    return ev.tick == tick && evt->type == fmidi_event_message && evt->data[0] == status;
+}
+
+int main()
+{
+    fmidi_smf_u out;
+
+    // an empty note, with sustain off
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(0, 96));
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xb0, 64, 0});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x80, 60, 64});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x80, 60, 64});
+    std::vector<Tick_Event> events = optimize(bld.get(), out);
+    CHECK(events.size() == 3);
+    CHECK(is_note(events[1], 0, 0x80));
+
+    // the retrigger of a note on, which keeps sounding until the note-off
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xb0, 64, 0});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x80, 60, 64});
+    events = optimize(bld.get(), out);
+    CHECK(events.size() == 4);
+    CHECK(is_note(events[1], 0, 0x90));
+    CHECK(is_note(events[2], 10, 0x80));
+
+    // a key which is maybe on
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xb0, 64, 0});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x80, 60, 64});
+    events = optimize(bld.get(), out);
+    CHECK(events.size() == 3);
+    CHECK(is_note(events[1], 10, 0x80));
+
+    // sustain which is maybe on
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x80, 60, 64});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x80, 60, 64});
+    events = optimize(bld.get(), out);
+    CHECK(events.size() == 4);
+
+    // a percussion hit
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0xb9, 64, 0});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x89, 38, 64});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x99, 38, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 10, {0x89, 38, 64});
+    events = optimize(bld.get(), out);
+    CHECK(events.size() == 5);
+
+    return test_failures != 0;
+}
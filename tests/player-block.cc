@@ -0,0 +1,87 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <vector>
+#include <new>
+#include <stdlib.h>
+#include <math.h>
+
+// the count of allocations, while counting is on
+static bool counting = false;
+static unsigned allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations += counting;
+    if (void *ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+int main()
+{
+    fmidi_smf_u smf(test_make_song(20000, 24));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    std::vector<double> times;
+    {
+        fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+        for (fmidi_seq_event_t sqevt; fmidi_seq_next_event(seq.get(), &sqevt);)
+            times.push_back(sqevt.time);
+    }
+
+    const double rate = 44100;
+    const uint32_t frames = 256;
+    const size_t max = 4;
+    fmidi_player_block_event_t events[max];
+
+    fmidi_player_u plr(fmidi_player_new(smf.get()));
+    fmidi_player_start(plr.get());
+
+    // every event at the frame of its time, without allocating
+    counting = true;
+    uint64_t block = 0;
+    size_t index = 0;
+    while (fmidi_player_running(plr.get())) {
+        double before = fmidi_player_current_time(plr.get());
+        size_t count = fmidi_player_render_block(plr.get(), rate, frames, events, max);
+        for (size_t i = 0; i < count && index < times.size(); ++i, ++index) {
+            uint64_t frame = block * frames + events[i].frame;
+            CHECK(frame == (uint64_t)floor(times[index] * rate));
+        }
+        if (fmidi_player_current_time(plr.get()) != before)
+            ++block;
+    }
+    counting = false;
+    CHECK(index == times.size());
+    CHECK(allocations == 0);
+
+    // the sequencer neither, once the first seek has allocated its index
+    fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+    fmidi_seq_seek(seq.get(), times.back() / 2);
+    fmidi_seq_seek(seq.get(), 0);
+    allocations = 0;
+    counting = true;
+    fmidi_seq_event_t sqevts[64];
+    while (fmidi_seq_next_events(seq.get(), sqevts, 64, times.back() + 1) > 0);
+    fmidi_seq_seek(seq.get(), times.back() / 3);
+    counting = false;
+    CHECK(allocations == 0);
+
+    return test_failures != 0;
+}
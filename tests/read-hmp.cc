@@ -0,0 +1,49 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <string.h>
+
+int main()
+{
+    // a track with a sysex and a text in the middle, between a note-on and
+    // its note-off, the lengths of which are standard variable-length values
+    fmidi_smf_u smf(fmidi_hmp_file_read("data/mid-meta.hmp"));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    const fmidi_smf_info_t *info = fmidi_smf_get_info(smf.get());
+    CHECK(info->track_count == 1);
+
+    fmidi_track_iter_t it;
+    fmidi_smf_track_begin(&it, 0);
+    const fmidi_event_t *evt;
+
+    CHECK((evt = fmidi_smf_track_next(smf.get(), &it)) &&
+          evt->type == fmidi_event_meta && evt->data[0] == 0x51);
+    CHECK((evt = fmidi_smf_track_next(smf.get(), &it)) &&
+          evt->type == fmidi_event_message && evt->datalen == 3 &&
+          evt->data[0] == 0x90 && evt->data[1] == 0x3c);
+
+    const uint8_t sysex[] = {0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7};
+    CHECK((evt = fmidi_smf_track_next(smf.get(), &it)) &&
+          evt->type == fmidi_event_message && evt->datalen == sizeof(sysex) &&
+          !memcmp(evt->data, sysex, sizeof(sysex)));
+
+    const uint8_t text[] = {0x01, 'h', 'i'};
+    CHECK((evt = fmidi_smf_track_next(smf.get(), &it)) &&
+          evt->type == fmidi_event_meta && evt->delta == 10 &&
+          evt->datalen == sizeof(text) && !memcmp(evt->data, text, sizeof(text)));
+
+    CHECK((evt = fmidi_smf_track_next(smf.get(), &it)) &&
+          evt->type == fmidi_event_message && evt->delta == 10 &&
+          evt->data[0] == 0x80 && evt->data[1] == 0x3c);
+    CHECK((evt = fmidi_smf_track_next(smf.get(), &it)) &&
+          evt->type == fmidi_event_meta && evt->data[0] == 0x2f);
+    CHECK(!fmidi_smf_track_next(smf.get(), &it));
+
+    return test_failures != 0;
+}
@@ -0,0 +1,71 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <stdlib.h>
+
+template <size_t N>
+static bool push(fmidi_recorder_t *rec, double time, const uint8_t (&data)[N])
+{
+    return fmidi_recorder_push(rec, time, data, N);
+}
+
+int main()
+{
+    fmidi_recorder_u rec(fmidi_recorder_new(96, 500000, 4096));
+    CHECK(rec);
+    if (!rec)
+        return 1;
+
+    // the messages which a file stores
+    CHECK(push(rec.get(), 0.0, {0x90, 60, 100}));
+    CHECK(push(rec.get(), 0.1, {0xc0, 5}));
+    CHECK(push(rec.get(), 0.2, {0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7}));
+    CHECK(push(rec.get(), 0.5, {0x80, 60, 64}));
+
+    // lengths which differ from those of the status
+    CHECK(!fmidi_recorder_push(rec.get(), 0.6, nullptr, 0));
+    CHECK(!push(rec.get(), 0.6, {0x90, 60}));
+    CHECK(!push(rec.get(), 0.6, {0x90, 60, 100, 0}));
+    CHECK(!push(rec.get(), 0.6, {0xc0, 5, 0}));
+    // data bytes and statuses which are not storable
+    CHECK(!push(rec.get(), 0.6, {60, 100}));
+    CHECK(!push(rec.get(), 0.6, {0x90, 0x80, 100}));
+    CHECK(!push(rec.get(), 0.6, {0xf7}));
+    CHECK(!push(rec.get(), 0.6, {0xf1, 0x10}));
+    CHECK(!push(rec.get(), 0.6, {0xf2, 0x10, 0x10}));
+    CHECK(!push(rec.get(), 0.6, {0xf4}));
+    CHECK(!push(rec.get(), 0.6, {0xf6}));
+    CHECK(!push(rec.get(), 0.6, {0xf8}));
+    CHECK(!push(rec.get(), 0.6, {0xfe}));
+    // system exclusives which are incomplete
+    CHECK(!push(rec.get(), 0.6, {0xf0}));
+    CHECK(!push(rec.get(), 0.6, {0xf0, 0x7e, 0x7f}));
+    CHECK(!push(rec.get(), 0.6, {0xf0, 0x7e, 0x90, 0xf7}));
+
+    // only the valid messages are recorded, and the file is a valid one
+    CHECK(fmidi_recorder_drain(rec.get()) == 4);
+    fmidi_smf_u smf(fmidi_recorder_finish(rec.get()));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    uint8_t *data = nullptr;
+    size_t length = 0;
+    CHECK(fmidi_smf_mem_write(smf.get(), &data, &length));
+    fmidi_smf_u reread(fmidi_smf_mem_read(data, length));
+    free(data);
+    CHECK(reread);
+    if (reread) {
+        fmidi_track_iter_t it;
+        fmidi_smf_track_begin(&it, 0);
+        unsigned messages = 0;
+        while (const fmidi_event_t *evt = fmidi_smf_track_next(reread.get(), &it))
+            messages += evt->type == fmidi_event_message;
+        CHECK(messages == 4);
+    }
+
+    return test_failures != 0;
+}
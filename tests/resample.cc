@@ -0,0 +1,69 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <math.h>
+
+// SMPTE units, of the frame rate and the delta units per frame
+static uint16_t smpte_unit(int fps, uint8_t tpf)
+{
+    return (uint16_t)(((uint8_t)-fps << 8) | tpf);
+}
+
+// the tick of the note of the single track, which follows the tempo if any
+static uint64_t note_tick(const fmidi_smf_t *smf)
+{
+    fmidi_track_iter_t it;
+    fmidi_smf_track_begin(&it, 0);
+    uint64_t tick = 0;
+    while (const fmidi_event_t *evt = fmidi_smf_track_next(smf, &it)) {
+        tick += evt->delta;
+        if (evt->type == fmidi_event_message)
+            return tick;
+    }
+    return ~(uint64_t)0;
+}
+
+static fmidi_smf_t *make_note(uint16_t unit, uint64_t tick)
+{
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(0, unit));
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, tick, {0x90, 60, 100});
+    return fmidi_smf_builder_finish(bld.get());
+}
+
+int main()
+{
+    // SMPTE 29 is 30 drop-frame: 30000 units of 100 per frame are 10.01 s
+    const uint16_t unit29 = smpte_unit(29, 100);
+    fmidi_smf_u smf29(make_note(unit29, 30000));
+    CHECK(smf29);
+    if (!smf29)
+        return 1;
+
+    fmidi_seq_u seq(fmidi_seq_new(smf29.get()));
+    fmidi_seq_event_t sqevt;
+    CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(fabs(sqevt.time - 10.01) < 1e-9);
+
+    // to metrical, of 192 units per second at the fixed tempo
+    fmidi_smf_u out(fmidi_smf_resample(smf29.get(), 96, fmidi_round_nearest));
+    CHECK(out && note_tick(out.get()) == 1922);
+
+    // to SMPTE 30, exactly
+    out.reset(fmidi_smf_resample(smf29.get(), smpte_unit(30, 100), fmidi_round_nearest));
+    CHECK(out && note_tick(out.get()) == 30030);
+
+    // and back from metrical, following the tempo
+    fmidi_smf_u smf96(make_note(96, 1922));
+    out.reset(fmidi_smf_resample(smf96.get(), unit29, fmidi_round_nearest));
+    CHECK(out && note_tick(out.get()) == 30001);
+
+    // between metrical units
+    out.reset(fmidi_smf_resample(smf96.get(), 480, fmidi_round_nearest));
+    CHECK(out && note_tick(out.get()) == 1922 * 5);
+
+    return test_failures != 0;
+}
@@ -0,0 +1,97 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+
+static bool is_message(const fmidi_seq_event_t &sqevt, uint8_t status, uint8_t key)
+{
+    const fmidi_event_t *evt = sqevt.event;
+    return evt->type == fmidi_event_message && evt->datalen == 3 &&
+        evt->data[0] == status && evt->data[1] == key;
+}
+
+int main()
+{
+    // a track which branches back to its start, with notes over the branch
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(0, 96));
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_xmi_branch_point, 0, {1});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 48, {0x91, 64, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 96, {0x80, 60, 64});
+    test_append(bld.get(), 0, fmidi_event_message, 96, {0x92, 67, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 96, {0x92, 67, 0});
+    test_append(bld.get(), 0, fmidi_event_message, 192, {0x81, 64, 64});
+    fmidi_smf_u smf(fmidi_smf_builder_finish(bld.get()));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+    fmidi_seq_event_t sqevt;
+    for (unsigned i = 0; i < 6; ++i)
+        CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(sqevt.tick == 96);
+    double time = sqevt.time;
+
+    // the note which is on is released, at the time of the branch
+    CHECK(fmidi_seq_branch(seq.get(), 0, 1));
+    CHECK(fmidi_seq_peek_event(seq.get(), &sqevt));
+    CHECK(is_message(sqevt, 0x81, 64));
+    CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(is_message(sqevt, 0x81, 64));
+    CHECK(sqevt.time == time);
+    CHECK(sqevt.track == 0);
+
+    // then the branch point, and the track from there
+    CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(sqevt.event->type == fmidi_event_xmi_branch_point);
+    CHECK(sqevt.time == time);
+    CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(is_message(sqevt, 0x90, 60));
+
+    // a branch with a note on, and the releases taken in a block
+    CHECK(fmidi_seq_branch(seq.get(), 0, 1));
+    fmidi_seq_event_t sqevts[4];
+    size_t count = fmidi_seq_next_events(seq.get(), sqevts, 4, time + 1);
+    CHECK(count == 4);
+    CHECK(is_message(sqevts[0], 0x80, 60));
+    CHECK(sqevts[1].event->type == fmidi_event_xmi_branch_point);
+    CHECK(is_message(sqevts[2], 0x90, 60));
+    CHECK(is_message(sqevts[3], 0x91, 64));
+
+    // a branch with no note on plays the branch point first
+    fmidi_seq_seek(seq.get(), time + 10);
+    CHECK(!fmidi_seq_peek_event(seq.get(), nullptr));
+    CHECK(fmidi_seq_branch(seq.get(), 0, 1));
+    CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(sqevt.event->type == fmidi_event_xmi_branch_point);
+
+    // a branch after a seek to a checkpoint releases the notes on before it,
+    // which the checkpoint does not keep
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_xmi_branch_point, 0, {1});
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x93, 48, 100});
+    for (unsigned i = 0; i < 3000; ++i) {
+        test_append(bld.get(), 0, fmidi_event_message, 10 * i, {0x90, 60, 100});
+        test_append(bld.get(), 0, fmidi_event_message, 10 * i + 5, {0x80, 60, 64});
+    }
+    test_append(bld.get(), 0, fmidi_event_message, 30000, {0x83, 48, 64});
+    smf.reset(fmidi_smf_builder_finish(bld.get()));
+    seq.reset(fmidi_seq_new(smf.get()));
+    time = fmidi_smf_compute_duration(smf.get());
+    fmidi_seq_seek(seq.get(), time + 1);
+    fmidi_seq_seek(seq.get(), time * 2 / 3);
+    CHECK(fmidi_seq_peek_event(seq.get(), &sqevt));
+    CHECK(is_message(sqevt, 0x90, 60));
+    CHECK(fmidi_seq_branch(seq.get(), 0, 1));
+    CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(is_message(sqevt, 0x83, 48));
+    CHECK(sqevt.time < time * 2 / 3);
+    CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+    CHECK(sqevt.event->type == fmidi_event_xmi_branch_point);
+
+    return test_failures != 0;
+}
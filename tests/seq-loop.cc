@@ -0,0 +1,70 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+int main()
+{
+    fmidi_smf_u smf(test_make_song(5000));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    const fmidi_loop_t loop{2000, 20000};
+    fmidi_tempo_map_u map(fmidi_tempo_map_new(smf.get(), 0));
+    double period = fmidi_tempo_map_tick_to_seconds(map.get(), loop.end) -
+        fmidi_tempo_map_tick_to_seconds(map.get(), loop.start);
+    double song_end = fmidi_smf_compute_duration(smf.get());
+
+    // some repetitions of the loop, until past the end of the song
+    std::vector<fmidi_seq_event_t> events;
+    fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+    CHECK(fmidi_seq_set_loop(seq.get(), &loop));
+    for (fmidi_seq_event_t sqevt; fmidi_seq_next_event(seq.get(), &sqevt);) {
+        CHECK(sqevt.tick <= loop.end);
+        CHECK(events.empty() || sqevt.time >= events.back().time);
+        events.push_back(sqevt);
+        if (sqevt.time > song_end + 60)
+            break;
+    }
+
+    // the repetitions are shifted by the length of the loop
+    size_t first = 0;
+    while (events[first].tick < loop.start)
+        ++first;
+    size_t length = 0;
+    while (events[first + length + 1].tick >= events[first + length].tick)
+        ++length;
+    ++length;
+    for (size_t i = first + length; i < events.size(); ++i) {
+        const fmidi_seq_event_t &before = events[i - length];
+        CHECK(events[i].event == before.event);
+        CHECK(fabs(events[i].time - (before.time + period)) < 1e-6);
+    }
+
+    // seek after the loop is set, with an index which covers all the song
+    seq.reset(fmidi_seq_new(smf.get()));
+    fmidi_seq_seek(seq.get(), song_end + 1);
+    CHECK(!fmidi_seq_peek_event(seq.get(), nullptr));
+    CHECK(fmidi_seq_set_loop(seq.get(), &loop));
+    srand(1);
+    for (unsigned n = 0; n < 200; ++n) {
+        size_t index = (n == 0) ? (events.size() - 1) : ((size_t)rand() % events.size());
+        double time = (n == 0) ? (song_end + 22) : events[index].time;
+        while (index > 0 && events[index - 1].time >= time)
+            --index;
+        fmidi_seq_seek(seq.get(), time);
+        fmidi_seq_event_t sqevt;
+        CHECK(fmidi_seq_peek_event(seq.get(), &sqevt));
+        CHECK(sqevt.event == events[index].event);
+        CHECK(sqevt.tick == events[index].tick);
+        CHECK(fabs(sqevt.time - events[index].time) < 1e-6);
+    }
+
+    return test_failures != 0;
+}
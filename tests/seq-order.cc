@@ -0,0 +1,50 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+
+int main()
+{
+    // independent tracks with events at the same time, the first track at a
+    // later tick, having a faster tempo
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(2, 96));
+    fmidi_smf_builder_add_track(bld.get());
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_meta, 0, {0x51, 0x03, 0xd0, 0x90});
+    test_append(bld.get(), 0, fmidi_event_message, 192, {0x90, 60, 100});
+    test_append(bld.get(), 1, fmidi_event_message, 96, {0x91, 60, 100});
+    test_append(bld.get(), 1, fmidi_event_message, 192, {0x81, 60, 64});
+    test_append(bld.get(), 0, fmidi_event_message, 384, {0x80, 60, 64});
+    fmidi_smf_u smf(fmidi_smf_builder_finish(bld.get()));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    // at a same time, the events come by track, whatever their tick
+    const uint8_t expected[][2] = {
+        {0, 0x51}, {0, 0x90}, {1, 0x91}, {0, 0x80}, {1, 0x81},
+    };
+    fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+    fmidi_seq_event_t sqevt;
+    for (const uint8_t (&ev)[2] : expected) {
+        CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+        CHECK(sqevt.track == ev[0] && sqevt.event->data[0] == ev[1]);
+    }
+    CHECK(!fmidi_seq_next_event(seq.get(), &sqevt));
+
+    // and the timeline has the order of the sequencer
+    fmidi_timeline_u tl(fmidi_timeline_new(smf.get()));
+    CHECK(tl);
+    if (!tl)
+        return 1;
+    size_t count = 0;
+    const fmidi_timeline_entry_t *entries = fmidi_timeline_entries(tl.get(), &count);
+    const size_t expected_count = sizeof(expected) / sizeof(expected[0]);
+    CHECK(count == expected_count);
+    for (size_t i = 0; i < count && i < expected_count; ++i)
+        CHECK(entries[i].track == expected[i][0] && entries[i].event->data[0] == expected[i][1]);
+
+    return test_failures != 0;
+}
@@ -0,0 +1,48 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <vector>
+#include <stdlib.h>
+
+int main()
+{
+    fmidi_smf_u smf(test_make_song(5000));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    std::vector<fmidi_seq_event_t> events;
+    fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+    for (fmidi_seq_event_t sqevt; fmidi_seq_next_event(seq.get(), &sqevt);)
+        events.push_back(sqevt);
+    CHECK(events.size() == 5000 * 2 + 50);
+
+    // seek to random times, in both directions
+    srand(1);
+    fmidi_seq_rewind(seq.get());
+    for (unsigned n = 0; n < 500; ++n) {
+        size_t index = (size_t)rand() % events.size();
+        double time = events[index].time;
+        while (index > 0 && events[index - 1].time >= time)
+            --index;
+        fmidi_seq_seek(seq.get(), time);
+        fmidi_seq_event_t sqevt;
+        CHECK(fmidi_seq_peek_event(seq.get(), &sqevt));
+        CHECK(sqevt.event == events[index].event);
+        CHECK(sqevt.time == events[index].time);
+        // play a little from there
+        for (unsigned i = 1; i < 10 && index + i < events.size(); ++i) {
+            CHECK(fmidi_seq_next_event(seq.get(), &sqevt));
+            CHECK(sqevt.event == events[index + i - 1].event);
+        }
+    }
+
+    // seeking past the end leaves nothing to play
+    fmidi_seq_seek(seq.get(), events.back().time + 1);
+    CHECK(!fmidi_seq_peek_event(seq.get(), nullptr));
+
+    return test_failures != 0;
+}
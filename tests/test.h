@@ -0,0 +1,54 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <fmidi/fmidi.h>
+#include <stdio.h>
+
+///////////
+// TESTS //
+///////////
+
+// the count of failed checks, which is the exit status of the test
+static unsigned test_failures = 0;
+
+#define CHECK(x) do {                                                   \
+        if (!(x)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #x);                            \
+            ++test_failures;                                            \
+        }                                                               \
+    } while (0)
+
+// appends an event to a track of the builder, at an absolute tick
+template <size_t N>
+inline void test_append(
+    fmidi_smf_builder_t *bld, uint16_t track, fmidi_event_type_t type,
+    uint64_t tick, const uint8_t (&data)[N])
+{
+    if (!fmidi_smf_builder_append_at(bld, track, type, tick, data, N)) {
+        fprintf(stderr, "cannot append an event: %s\n", fmidi_strerror(fmidi_errno()));
+        ++test_failures;
+    }
+}
+
+// A file of a single track, format 1 with 96 ticks per beat, with notes at a
+// regular interval and tempo changes. It has the given count of notes.
+inline fmidi_smf_t *test_make_song(unsigned notes, uint32_t interval = 48)
+{
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(1, 96));
+    fmidi_smf_builder_add_track(bld.get());
+    for (unsigned i = 0; i < notes; ++i) {
+        uint64_t tick = (uint64_t)i * interval;
+        if (i % 100 == 0) {
+            uint8_t tempo = (uint8_t)(0x05 + (i / 100) % 5);
+            test_append(bld.get(), 0, fmidi_event_meta, tick, {0x51, tempo, 0x00, 0x00});
+        }
+        uint8_t key = (uint8_t)(48 + i % 24);
+        test_append(bld.get(), 0, fmidi_event_message, tick, {0x90, key, 100});
+        test_append(bld.get(), 0, fmidi_event_message, tick + interval / 2, {0x80, key, 64});
+    }
+    return fmidi_smf_builder_finish(bld.get());
+}
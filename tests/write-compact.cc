@@ -0,0 +1,72 @@
+//          Copyright Jean Pierre Cimalando 2018-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test.h"
+#include <stdlib.h>
+
+// the length of the file written with the flags
+static size_t written_length(const fmidi_smf_t *smf, unsigned flags)
+{
+    uint8_t *data = nullptr;
+    size_t length = 0;
+    if (!fmidi_smf_mem_write_ex(smf, &data, &length, flags))
+        return 0;
+    free(data);
+    return length;
+}
+
+int main()
+{
+    fmidi_smf_u smf(test_make_song(1000));
+    CHECK(smf);
+    if (!smf)
+        return 1;
+
+    size_t standard = written_length(smf.get(), 0);
+    CHECK(standard == fmidi_smf_encoded_size(smf.get()));
+    CHECK(fmidi_smf_encoded_savings(smf.get(), 0) == 0);
+
+    // the note-offs become note-ons in running status, one byte less each
+    size_t saved = fmidi_smf_encoded_savings(smf.get(), fmidi_write_noteoff_as_noteon);
+    CHECK(saved >= 1000 - 10);
+    CHECK(written_length(smf.get(), fmidi_write_noteoff_as_noteon) == standard - saved);
+
+    saved = fmidi_smf_encoded_savings(smf.get(), fmidi_write_compact);
+    CHECK(saved > 0);
+    CHECK(written_length(smf.get(), fmidi_write_compact) == standard - saved);
+
+    // the end of track comes at the last event, as the sequencer ends there
+    fmidi_smf_builder_u bld(fmidi_smf_builder_new(1, 96));
+    fmidi_smf_builder_add_track(bld.get());
+    test_append(bld.get(), 0, fmidi_event_message, 0, {0x90, 60, 100});
+    test_append(bld.get(), 0, fmidi_event_message, 96, {0x80, 60, 64});
+    test_append(bld.get(), 0, fmidi_event_meta, 960, {0x2f});
+    smf.reset(fmidi_smf_builder_finish(bld.get()));
+    CHECK(fmidi_smf_encoded_savings(smf.get(), fmidi_write_trim_track_end) == 1);
+    uint8_t *data = nullptr;
+    size_t length = 0;
+    CHECK(fmidi_smf_mem_write_ex(smf.get(), &data, &length, fmidi_write_trim_track_end));
+    fmidi_smf_u trimmed(fmidi_smf_mem_read(data, length));
+    free(data);
+    CHECK(trimmed && fmidi_smf_compute_duration(trimmed.get()) ==
+          fmidi_smf_compute_duration(smf.get()));
+
+    // the meta events past the end of track, which the reader keeps, are dropped
+    static const uint8_t past_end[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 14,
+        0x00, 0x90, 60, 100,
+        0x60, 0xff, 0x2f, 0x00,
+        0x00, 0xff, 0x01, 0x02, 'h', 'i',
+    };
+    smf.reset(fmidi_smf_mem_read(past_end, sizeof(past_end)));
+    CHECK(smf);
+    if (smf) {
+        CHECK(written_length(smf.get(), 0) == sizeof(past_end));
+        CHECK(written_length(smf.get(), fmidi_write_trim_track_end) == sizeof(past_end) - 6);
+    }
+
+    return test_failures != 0;
+}